@@ -3,6 +3,6 @@ gcc -Og -g -lm -c -Wall -Wextra src/decoder/*.c
 mkdir -p o
 mv *.o o
 
-# build everything else
-gcc -o z64decompress src/*.c o/*.o -Wall -Wextra -Og -g
+# build everything else (src/lib.c is the library's, not the program's)
+gcc -pthread -o z64decompress $(ls src/*.c | grep -v '^src/lib\.c$') o/*.o -Wall -Wextra -Og -g
 
@@ -3,8 +3,8 @@ gcc -m32 -DNDEBUG -s -Ofast -flto -lm -c -Wall src/decoder/*.c
 mkdir -p o
 mv *.o o
 
-# build everything else
-gcc -m32 -o z64decompress -DNDEBUG src/*.c o/*.o -Wall -Wextra -s -Os -flto
+# build everything else (src/lib.c is the library's, not the program's)
+gcc -m32 -pthread -o z64decompress -DNDEBUG $(ls src/*.c | grep -v '^src/lib\.c$') o/*.o -Wall -Wextra -s -Os -flto
 
 # move to bin directory
 mkdir -p bin/linux32
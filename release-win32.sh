@@ -3,8 +3,8 @@
 mkdir -p o
 mv *.o o
 
-# build everything else
-~/c/mxe/usr/bin/i686-w64-mingw32.static-gcc -o z64decompress.exe -DNDEBUG src/*.c o/*.o -Wall -Wextra -s -Os -flto -mconsole -municode
+# build everything else (src/lib.c is the library's, not the program's)
+~/c/mxe/usr/bin/i686-w64-mingw32.static-gcc -o z64decompress.exe -DNDEBUG $(ls src/*.c | grep -v '^src/lib\.c$') o/*.o -Wall -Wextra -s -Os -flto -mconsole -municode -lpsapi
 
 # move to bin directory
 mkdir -p bin/win32
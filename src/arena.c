@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "wow.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK (64 * 1024) /* smallest block */
+
+struct arena_block
+{
+	struct arena_block *prev;
+	size_t size;
+	size_t used;
+	unsigned char *data;
+};
+
+/* add a block with room for at least `sz` bytes */
+static struct arena_block *arena_grow(struct arena *arena, size_t sz)
+{
+	struct arena_block *b;
+	size_t size = ARENA_BLOCK;
+
+	/* each block is as big as all the others together, so *
+	 * growing takes only a handful of blocks               */
+	if (size < arena->total)
+		size = arena->total;
+	if (size < sz)
+		size = sz;
+
+	b = malloc_safe(sizeof(*b) + size + ARENA_ALIGN);
+	b->prev = arena->block;
+	b->size = size;
+	b->used = 0;
+	b->data = (unsigned char *)(((size_t)(b + 1) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+	arena->block = b;
+	arena->total += size;
+
+	return b;
+}
+
+/* a piece of `sz` bytes, suitably aligned for anything */
+void *arena_alloc(struct arena *arena, size_t sz)
+{
+	struct arena_block *b = arena->block;
+	void *p;
+
+	sz = (sz + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (!b || b->size - b->used < sz)
+		b = arena_grow(arena, sz);
+
+	p = b->data + b->used;
+	b->used += sz;
+
+	return p;
+}
+
+/* a zeroed piece of `num` * `sz` bytes */
+void *arena_calloc(struct arena *arena, size_t num, size_t sz)
+{
+	void *p = arena_alloc(arena, num * sz);
+
+	memset(p, 0, num * sz);
+	return p;
+}
+
+/* give back every piece, keeping the memory for the next run */
+void arena_reset(struct arena *arena)
+{
+	struct arena_block *b = arena->block;
+
+	if (!b)
+		return;
+
+	/* one block big enough for everything the last run needed */
+	if (b->prev)
+	{
+		size_t total = arena->total;
+		
+		arena_free(arena);
+		arena_grow(arena, total);
+		return;
+	}
+
+	b->used = 0;
+}
+
+/* free everything the arena holds */
+void arena_free(struct arena *arena)
+{
+	struct arena_block *b;
+	struct arena_block *prev;
+
+	for (b = arena->block; b; b = prev)
+	{
+		prev = b->prev;
+		free(b);
+	}
+	arena->block = NULL;
+	arena->total = 0;
+}
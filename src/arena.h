@@ -0,0 +1,28 @@
+#ifndef Z64DECOMPRESS_ARENA_H_INCLUDED
+#define Z64DECOMPRESS_ARENA_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+/* memory handed out piece by piece and given back all at once; *
+ * what it holds is kept for the next run rather than freed, so *
+ * a long batch settles into a single block that's reused; an   *
+ * arena starts out zeroed                                      */
+struct arena
+{
+	struct arena_block *block; /* newest block, which pieces come from */
+	size_t total;              /* bytes in every block */
+};
+
+/* a piece of `sz` bytes, suitably aligned for anything */
+void *arena_alloc(struct arena *arena, size_t sz);
+
+/* a zeroed piece of `num` * `sz` bytes */
+void *arena_calloc(struct arena *arena, size_t num, size_t sz);
+
+/* give back every piece, keeping the memory for the next run */
+void arena_reset(struct arena *arena);
+
+/* free everything the arena holds */
+void arena_free(struct arena *arena);
+
+#endif /* Z64DECOMPRESS_ARENA_H_INCLUDED */
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "cache.h"
+#include "romview.h"
+#include "file.h"
+#include "wow.h"
+
+/* a compressed file being timed */
+typedef struct {
+	struct romview *view; /* rom it's in, or NULL if it's on its own */
+	int idx;              /* dma entry within view */
+	void *src;            /* file on its own */
+	size_t srcSz;         /* compressed size */
+	size_t decSz;         /* decompressed size */
+	Codec codec;
+	double latency;       /* median time to decompress, in seconds */
+} BenchFile;
+
+/* every input, and the files in them */
+typedef struct {
+	void **data;
+	struct romview **view;
+	int inputNum;
+	BenchFile *file;
+	int fileNum;
+	size_t decMax;        /* largest decompressed size */
+} BenchSet;
+
+/* what a codec did over the whole set, as kept in a baseline */
+typedef struct {
+	int files;
+	size_t out;           /* bytes decompressed */
+	unsigned long long hash; /* of everything decompressed, in order */
+	double mbps;          /* throughput */
+} BenchResult;
+
+/* qsort callback for times */
+static int cmp_double(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+/* add a file to the set */
+static BenchFile *bench_add(BenchSet *set)
+{
+	BenchFile *f;
+
+	set->file = realloc_safe(set->file, sizeof(*set->file) * (set->fileNum + 1));
+	f = set->file + set->fileNum++;
+	memset(f, 0, sizeof(*f));
+
+	return f;
+}
+
+/* load the inputs and find every compressed file in them */
+static void bench_load(BenchSet *set, char **input, int num, Codec codec, int headerless, int individual)
+{
+	int i;
+
+	memset(set, 0, sizeof(*set));
+	set->data = calloc_safe(num, sizeof(*set->data));
+	set->view = calloc_safe(num, sizeof(*set->view));
+	set->inputNum = num;
+
+	for (i = 0; i < num; ++i)
+	{
+		size_t sz;
+
+		set->data[i] = file_load(input[i], &sz);
+
+		if (individual)
+		{
+			BenchFile *f = bench_add(set);
+
+			f->src = set->data[i];
+			f->srcSz = sz;
+			f->decSz = z64dec_header_size(f->src, sz);
+			f->codec = codec;
+			if (f->codec == CODEC_NONE && sz >= 4)
+				f->codec = get_codec_type_from_header(f->src);
+			if (f->codec == CODEC_NONE || !f->decSz)
+				die("ERROR: '%s' is not a compressed file", input[i]);
+		}
+		else
+		{
+			struct romview *view = romview_open(set->data[i], sz, -1, codec, headerless);
+			int k;
+
+			if (!view)
+				die("failed to locate dmadata in '%s'", input[i]);
+			set->view[i] = view;
+
+			for (k = 0; k < romview_count(view); ++k)
+			{
+				struct romview_entry e;
+				BenchFile *f;
+
+				if (!romview_entry(view, k, &e) || !e.Pend)
+					continue;
+
+				f = bench_add(set);
+				f->view = view;
+				f->idx = k;
+				f->srcSz = e.Pend - e.Pstart;
+				f->decSz = e.Vend - e.Vstart;
+				f->codec = romview_codec(view, k);
+				if (f->codec == CODEC_NONE)
+					die("ERROR: '%s' dma entry %d, unknown encoding", input[i], k);
+			}
+		}
+	}
+
+	for (i = 0; i < set->fileNum; ++i)
+		if (set->file[i].decSz > set->decMax)
+			set->decMax = set->file[i].decSz;
+}
+
+/* free everything bench_load() loaded */
+static void bench_free(BenchSet *set)
+{
+	int i;
+
+	for (i = 0; i < set->inputNum; ++i)
+	{
+		romview_close(set->view[i]);
+		free(set->data[i]);
+	}
+	free(set->data);
+	free(set->view);
+	free(set->file);
+}
+
+/* decompress a file into dst */
+static size_t bench_decode(struct z64dec_ctx *ctx, BenchFile *f, void *dst, size_t dstSz)
+{
+	size_t sz;
+	Codec used;
+
+	if (f->view)
+		return romview_read(f->view, f->idx, dst, dstSz);
+
+	ctx->dst_max = dstSz;
+	sz = decompress(ctx, dst, f->src, f->srcSz, f->codec, &used);
+	ctx->dst_max = 0;
+
+	return sz;
+}
+
+/* read the result of each codec from a baseline; returns 0 if *
+ * there is none yet                                           */
+static int baseline_load(const char *name, BenchResult result[CODEC_MAX], int found[CODEC_MAX])
+{
+	char line[256];
+	FILE *fp;
+	
+	memset(found, 0, sizeof(*found) * CODEC_MAX);
+	if (!(fp = fopen(name, "r")))
+		return 0;
+	
+	while (fgets(line, sizeof(line), fp))
+	{
+		BenchResult res;
+		char codecName[16];
+		Codec c;
+		
+		if (*line == '#' || *line == '\n')
+			continue;
+		if (sscanf(line, "%15s %d %zu %llx %lf", codecName, &res.files, &res.out, &res.hash, &res.mbps) != 5)
+			die("ERROR: '%s' is not a --bench baseline", name);
+		if ((c = get_codec_type_from_name(codecName)) == CODEC_NONE)
+			die("ERROR: '%s' is not a --bench baseline", name);
+		result[c] = res;
+		found[c] = 1;
+	}
+	fclose(fp);
+	
+	return 1;
+}
+
+/* write the result of each codec to a new baseline */
+static void baseline_save(const char *name, const BenchResult result[CODEC_MAX])
+{
+	FILE *fp;
+	int c;
+	
+	if (!(fp = fopen(name, "w")))
+		die("ERROR: failed to open '%s' for writing", name);
+	
+	fprintf(fp, "# z64decompress --bench baseline: codec, files, bytes out, hash of output, MB/s\n");
+	for (c = 0; c < CODEC_MAX; ++c)
+		if (result[c].files)
+			fprintf(fp, "%s %d %zu %016llx %.1f\n", decCodecInfo[c].name
+				, result[c].files, result[c].out, result[c].hash, result[c].mbps
+			);
+	
+	if (fclose(fp))
+		die("ERROR: failed to write '%s'", name);
+}
+
+/* compare each codec with a baseline, printing how it did to stdout; *
+ * returns the number of codecs that changed or got slower            */
+static int baseline_check(const BenchResult result[CODEC_MAX], const BenchResult base[CODEC_MAX], const int found[CODEC_MAX], double tolerance)
+{
+	int bad = 0;
+	int c;
+	
+	for (c = 0; c < CODEC_MAX; ++c)
+	{
+		const BenchResult *now = result + c;
+		const BenchResult *was = base + c;
+		const char *verdict = "ok";
+		
+		if (!now->files)
+			continue;
+		
+		if (!found[c])
+		{
+			printf("%-5s %8.1f MB/s, not in baseline\n", decCodecInfo[c].name, now->mbps);
+			continue;
+		}
+		
+		if (now->files != was->files || now->out != was->out || now->hash != was->hash)
+			verdict = "OUTPUT CHANGED";
+		else if (now->mbps < was->mbps * (1 - tolerance / 100))
+			verdict = "SLOWER";
+		bad += verdict[0] != 'o';
+		
+		printf("%-5s %8.1f MB/s, baseline %8.1f MB/s (%+.1f%%) %s\n", decCodecInfo[c].name
+			, now->mbps, was->mbps
+			, was->mbps > 0 ? (now->mbps / was->mbps - 1) * 100 : 0
+			, verdict
+		);
+	}
+	
+	return bad;
+}
+
+/* nearest-rank percentile of sorted times */
+static double percentile(const double *sorted, int num, int pct)
+{
+	int rank = (pct * num + 99) / 100;
+
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/* time every decoder over the compressed files in a list of roms *
+ * (or, with `individual`, of compressed files), decompressing    *
+ * each once to warm up and then `reps` times, and print the      *
+ * throughput and per-file latency of each codec to stdout;       *
+ * `codec` and `headerless` are as for romview_open()             */
+int bench_run(char **input, int num, int reps, Codec codec, int headerless, int individual, const char *baseline, double tolerance)
+{
+	BenchResult result[CODEC_MAX] = { { 0 } };
+	BenchResult base[CODEC_MAX];
+	int found[CODEC_MAX];
+	struct z64dec_ctx ctx;
+	BenchSet set;
+	int bad = 0;
+	void *dst;
+	double *times;
+	double *sorted;
+	int c;
+	int i;
+
+	bench_load(&set, input, num, codec, headerless, individual);
+	if (!set.fileNum)
+		die("ERROR: no compressed files to benchmark");
+
+	/* the whole file is always in memory */
+	z64dec_ctx_init(&ctx, Z64DEC_FLAT);
+	dst = malloc_safe(set.decMax);
+	times = malloc_safe(sizeof(*times) * reps);
+	sorted = malloc_safe(sizeof(*sorted) * set.fileNum);
+
+	printf("%d %s, %d %s of each\n"
+		, set.fileNum, set.fileNum == 1 ? "file" : "files"
+		, reps, reps == 1 ? "repetition" : "repetitions"
+	);
+	printf("codec  files   in MiB  out MiB     MB/s   p50 us   p90 us   p99 us   max us\n");
+
+	/* each codec is timed on its own, so its decoder stays warm */
+	for (c = 0; c < CODEC_MAX; ++c)
+	{
+		size_t inSz = 0;
+		size_t outSz = 0;
+		double total = 0;
+		unsigned long long hash = 0;
+		int n = 0;
+
+		for (i = 0; i < set.fileNum; ++i)
+		{
+			BenchFile *f = set.file + i;
+			size_t sz;
+			int r;
+
+			if (f->codec != (Codec)c)
+				continue;
+
+			/* warm up, and note what it decompressed to */
+			if (!(sz = bench_decode(&ctx, f, dst, set.decMax)))
+				die("ERROR: failed to decompress a %s file", decCodecInfo[c].name);
+			hash = dec_cache_hash(dst, sz) ^ (hash * 0x9E3779B185EBCA87ull);
+
+			for (r = 0; r < reps; ++r)
+			{
+				double start = wow_time();
+
+				bench_decode(&ctx, f, dst, set.decMax);
+				times[r] = wow_time() - start;
+				total += times[r];
+			}
+
+			qsort(times, reps, sizeof(*times), cmp_double);
+			f->latency = times[reps / 2];
+			sorted[n++] = f->latency;
+			inSz += f->srcSz;
+			outSz += f->decSz;
+		}
+
+		if (!n)
+			continue;
+
+		result[c].files = n;
+		result[c].out = outSz;
+		result[c].hash = hash;
+		result[c].mbps = total > 0 ? (double)outSz * reps / total / 1e6 : 0;
+		
+		qsort(sorted, n, sizeof(*sorted), cmp_double);
+		printf("%-5s %6d %8.2f %8.2f %8.1f %8.1f %8.1f %8.1f %8.1f\n"
+			, decCodecInfo[c].name
+			, n
+			, inSz / (1024.0 * 1024.0)
+			, outSz / (1024.0 * 1024.0)
+			, result[c].mbps
+			, percentile(sorted, n, 50) * 1e6
+			, percentile(sorted, n, 90) * 1e6
+			, percentile(sorted, n, 99) * 1e6
+			, sorted[n - 1] * 1e6
+		);
+	}
+
+	printf("peak rss: %.1f MiB\n", wow_peak_rss() / (1024.0 * 1024.0));
+	
+	/* the first run records the baseline that later ones are held to */
+	if (baseline && baseline_load(baseline, base, found))
+		bad = baseline_check(result, base, found, tolerance);
+	else if (baseline)
+	{
+		baseline_save(baseline, result);
+		printf("baseline written to '%s'\n", baseline);
+	}
+
+	/* cleanup */
+	free(sorted);
+	free(times);
+	free(dst);
+	bench_free(&set);
+	
+	return bad;
+}
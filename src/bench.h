@@ -0,0 +1,19 @@
+#ifndef Z64DECOMPRESS_BENCH_H_INCLUDED
+#define Z64DECOMPRESS_BENCH_H_INCLUDED
+
+#include "codec.h"
+
+/* time every decoder over the compressed files in a list of roms *
+ * (or, with `individual`, of compressed files), decompressing    *
+ * each once to warm up and then `reps` times, and print the      *
+ * throughput and per-file latency of each codec to stdout;       *
+ * `codec` and `headerless` are as for romview_open()             *
+ *                                                                *
+ * if `baseline` isn't NULL, the throughput of each codec and a   *
+ * hash of everything it decompressed are written to it, or if it *
+ * exists already, checked against it; returns the number of      *
+ * codecs whose output changed, or that are more than `tolerance` *
+ * percent slower than recorded                                   */
+int bench_run(char **input, int num, int reps, Codec codec, int headerless, int individual, const char *baseline, double tolerance);
+
+#endif /* Z64DECOMPRESS_BENCH_H_INCLUDED */
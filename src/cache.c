@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "wow.h"
+#undef   fopen
+#undef   fread
+#undef   fwrite
+#define  fopen   wow_fopen
+#define  fread   wow_fread
+#define  fwrite  wow_fwrite
+
+/* sidecar layout, all big-endian: the magic, the number of entries, *
+ * then each entry as its fields in struct order; the last character *
+ * of the magic is the version, bumped whenever the layout changes   *
+ * (version 1 stored codecs as the values of an internal enum)       */
+static const char cacheMagic[8] = { 'z', '6', '4', 'd', 'c', 'c', 'h', '2' };
+#define CACHE_ENTRY_SIZE (8 + 8 + 4 * 4 + DEC_CACHE_CODEC)
+
+struct dec_cache
+{
+	struct dec_cache_entry *entry; /* sorted by srcHash */
+	int num;
+	FILE *prev;                    /* the previous output */
+};
+
+/* xxh64-style mixing */
+#define P1 0x9E3779B185EBCA87ull
+#define P2 0xC2B2AE3D27D4EB4Full
+#define P3 0x165667B19E3779F9ull
+#define ROTL(X, N) (((X) << (N)) | ((X) >> (64 - (N))))
+
+/* 8 bytes as little-endian no matter the host's byte order, so a *
+ * sidecar written on one machine hashes the same on another; on   *
+ * little-endian hosts compilers turn this into a single load      */
+static inline unsigned long long rd64(const unsigned char *p)
+{
+	return (unsigned long long)p[0]
+		| (unsigned long long)p[1] << 8
+		| (unsigned long long)p[2] << 16
+		| (unsigned long long)p[3] << 24
+		| (unsigned long long)p[4] << 32
+		| (unsigned long long)p[5] << 40
+		| (unsigned long long)p[6] << 48
+		| (unsigned long long)p[7] << 56;
+}
+
+static inline unsigned long long round64(unsigned long long acc, unsigned long long v)
+{
+	acc += v * P2;
+	acc = ROTL(acc, 31);
+	return acc * P1;
+}
+
+/* fast non-cryptographic hash */
+unsigned long long dec_cache_hash(const void *data, size_t sz)
+{
+	const unsigned char *p = data;
+	const unsigned char *end = p + sz;
+	unsigned long long a = P1 + P2;
+	unsigned long long b = P2;
+	unsigned long long c = 0;
+	unsigned long long d = -P1;
+	unsigned long long h;
+
+	/* four independent lanes keep the multiplier busy */
+	for (; end - p >= 32; p += 32)
+	{
+		a = round64(a, rd64(p +  0));
+		b = round64(b, rd64(p +  8));
+		c = round64(c, rd64(p + 16));
+		d = round64(d, rd64(p + 24));
+	}
+	h = ROTL(a, 1) + ROTL(b, 7) + ROTL(c, 12) + ROTL(d, 18) + sz;
+
+	for (; end - p >= 8; p += 8)
+		h = ROTL(h ^ round64(0, rd64(p)), 27) * P1 + P3;
+
+	if (p < end)
+	{
+		unsigned char tail[8] = { 0 };
+
+		memcpy(tail, p, end - p);
+		h = ROTL(h ^ round64(0, rd64(tail)), 27) * P1 + P3;
+	}
+
+	/* final avalanche */
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/* big-endian bytes to and from integers */
+static unsigned long long get_be(const unsigned char *b, int n)
+{
+	unsigned long long v = 0;
+
+	while (n--)
+		v = (v << 8) | *b++;
+	return v;
+}
+static void put_be(unsigned char *b, unsigned long long v, int n)
+{
+	while (n--)
+	{
+		b[n] = v;
+		v >>= 8;
+	}
+}
+
+/* qsort callback for entries */
+static int cmp_entry_hash(const void *a, const void *b)
+{
+	const struct dec_cache_entry *ea = a;
+	const struct dec_cache_entry *eb = b;
+
+	return (ea->srcHash > eb->srcHash) - (ea->srcHash < eb->srcHash);
+}
+
+/* sidecar name of an output */
+static char *cache_name(const char *outName)
+{
+	char *name = malloc_safe(strlen(outName) + sizeof(DEC_CACHE_EXT));
+
+	strcpy(name, outName);
+	strcat(name, DEC_CACHE_EXT);
+	return name;
+}
+
+/* load the sidecar of a previous output; returns NULL if either *
+ * is missing, or the sidecar can't be read                      */
+struct dec_cache *dec_cache_load(const char *outName)
+{
+	struct dec_cache *cache;
+	unsigned char head[sizeof(cacheMagic) + 4];
+	unsigned char *raw;
+	char *name = cache_name(outName);
+	FILE *fp;
+	int num;
+	int i;
+
+	fp = fopen(name, "rb");
+	free(name);
+	if (!fp)
+		return NULL;
+
+	/* a sidecar that doesn't look right is as good as none */
+	if (fread(head, 1, sizeof(head), fp) != sizeof(head)
+		|| memcmp(head, cacheMagic, sizeof(cacheMagic))
+		|| (num = get_be(head + sizeof(cacheMagic), 4)) < 0
+		|| num > 0x100000
+	)
+	{
+		fclose(fp);
+		return NULL;
+	}
+	raw = malloc_safe((size_t)num * CACHE_ENTRY_SIZE + 1);
+	if (fread(raw, CACHE_ENTRY_SIZE, num, fp) != (size_t)num)
+	{
+		free(raw);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	cache = calloc_safe(1, sizeof(*cache));
+	cache->prev = fopen(outName, "rb");
+	if (!cache->prev)
+	{
+		free(raw);
+		free(cache);
+		return NULL;
+	}
+
+	cache->num = num;
+	cache->entry = malloc_safe(sizeof(*cache->entry) * (num + 1));
+	for (i = 0; i < num; ++i)
+	{
+		const unsigned char *b = raw + i * CACHE_ENTRY_SIZE;
+		struct dec_cache_entry *e = cache->entry + i;
+
+		e->srcHash  = get_be(b +  0, 8);
+		e->decHash  = get_be(b +  8, 8);
+		e->srcSz    = get_be(b + 16, 4);
+		e->offset   = get_be(b + 20, 4);
+		e->decSz    = get_be(b + 24, 4);
+		e->headerSz = get_be(b + 28, 4);
+		memcpy(e->codec, b + 32, DEC_CACHE_CODEC);
+	}
+	free(raw);
+
+	qsort(cache->entry, num, sizeof(*cache->entry), cmp_entry_hash);
+
+	return cache;
+}
+
+/* look for a file decompressed from the same bytes in the same way, *
+ * by the codec named `codec` after copying headerSz bytes as-is; if  *
+ * the previous output still holds what it decompressed to, read     *
+ * that into dst, set *decHash to its hash, and return non-zero       */
+int dec_cache_fetch(struct dec_cache *cache, unsigned long long srcHash, size_t srcSz, const char *codec, size_t headerSz, void *dst, size_t decSz, unsigned long long *decHash)
+{
+	int lo = 0;
+	int hi = cache->num;
+
+	/* first entry with this hash */
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+
+		if (cache->entry[mid].srcHash < srcHash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < cache->num && cache->entry[lo].srcHash == srcHash; ++lo)
+	{
+		const struct dec_cache_entry *e = cache->entry + lo;
+
+		if (e->srcSz != srcSz || e->headerSz != headerSz || e->decSz != decSz
+			|| strncmp(e->codec, codec, DEC_CACHE_CODEC)
+		)
+			continue;
+
+		/* the previous output may have changed since */
+		if (fseek(cache->prev, e->offset, SEEK_SET)
+			|| fread(dst, 1, decSz, cache->prev) != decSz
+			|| dec_cache_hash(dst, decSz) != e->decHash
+		)
+			continue;
+
+		*decHash = e->decHash;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* close a previous output and free its sidecar */
+void dec_cache_free(struct dec_cache *cache)
+{
+	if (!cache)
+		return;
+
+	fclose(cache->prev);
+	free(cache->entry);
+	free(cache);
+}
+
+/* write the sidecar of a new output */
+void dec_cache_save(const char *outName, const struct dec_cache_entry *entry, int num)
+{
+	unsigned char *raw;
+	unsigned char *b;
+	char *name = cache_name(outName);
+	FILE *fp;
+	int i;
+
+	raw = malloc_safe(sizeof(cacheMagic) + 4 + (size_t)num * CACHE_ENTRY_SIZE);
+	memcpy(raw, cacheMagic, sizeof(cacheMagic));
+	put_be(raw + sizeof(cacheMagic), num, 4);
+	for (i = 0, b = raw + sizeof(cacheMagic) + 4; i < num; ++i, b += CACHE_ENTRY_SIZE)
+	{
+		const struct dec_cache_entry *e = entry + i;
+
+		put_be(b +  0, e->srcHash, 8);
+		put_be(b +  8, e->decHash, 8);
+		put_be(b + 16, e->srcSz, 4);
+		put_be(b + 20, e->offset, 4);
+		put_be(b + 24, e->decSz, 4);
+		put_be(b + 28, e->headerSz, 4);
+		memcpy(b + 32, e->codec, DEC_CACHE_CODEC);
+	}
+
+	fp = fopen(name, "wb");
+	if (!fp || fwrite(raw, 1, b - raw, fp) != (size_t)(b - raw))
+		die("failed to write cache '%s'", name);
+	fclose(fp);
+
+	free(name);
+	free(raw);
+}
@@ -0,0 +1,46 @@
+#ifndef Z64DECOMPRESS_CACHE_H_INCLUDED
+#define Z64DECOMPRESS_CACHE_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+/* the sidecar of an output is its name with this appended */
+#define DEC_CACHE_EXT ".cache"
+
+/* room for a codec's name in a sidecar entry */
+#define DEC_CACHE_CODEC 8
+
+/* a file that was decompressed into an output, as listed in its sidecar */
+struct dec_cache_entry
+{
+	unsigned long long srcHash;  /* hash of the bytes given to the decoder */
+	unsigned long long decHash;  /* hash of what they decompressed to */
+	unsigned srcSz;
+	unsigned offset;             /* where they were decompressed to */
+	unsigned decSz;
+	unsigned headerSz;           /* bytes copied ahead of the compressed data */
+	char codec[DEC_CACHE_CODEC]; /* name of the codec, padded with zeroes */
+};
+
+/* the sidecar of a previous output, and the output itself */
+struct dec_cache;
+
+/* fast non-cryptographic hash */
+unsigned long long dec_cache_hash(const void *data, size_t sz);
+
+/* load the sidecar of a previous output; returns NULL if either *
+ * is missing, or the sidecar can't be read                      */
+struct dec_cache *dec_cache_load(const char *outName);
+
+/* look for a file decompressed from the same bytes in the same way, *
+ * by the codec named `codec` after copying headerSz bytes as-is; if  *
+ * the previous output still holds what it decompressed to, read     *
+ * that into dst, set *decHash to its hash, and return non-zero       */
+int dec_cache_fetch(struct dec_cache *cache, unsigned long long srcHash, size_t srcSz, const char *codec, size_t headerSz, void *dst, size_t decSz, unsigned long long *decHash);
+
+/* close a previous output and free its sidecar */
+void dec_cache_free(struct dec_cache *cache);
+
+/* write the sidecar of a new output */
+void dec_cache_save(const char *outName, const struct dec_cache_entry *entry, int num);
+
+#endif /* Z64DECOMPRESS_CACHE_H_INCLUDED */
@@ -0,0 +1,68 @@
+#include <string.h>
+#include <assert.h>
+
+#include "codec.h"
+#include "wow.h"
+
+const CodecInfo decCodecInfo[CODEC_MAX] = {
+	[CODEC_YAZ0]  = { "yaz"  , "Yaz0", yazdec_ctx },
+	[CODEC_LZO]   = { "lzo"  , "LZO0", lzodec_ctx },
+	[CODEC_UCL]   = { "ucl"  , "UCL0", ucldec_ctx },
+	[CODEC_APLIB] = { "aplib", "APL0", apldec_ctx },
+	[CODEC_ZLIB ] = { "zlib" , "ZLIB", zlibdec_ctx },
+};
+
+Codec get_codec_type_from_name(const char *name)
+{
+	for (int i = 0; i < CODEC_MAX; i++)
+	{
+		if (!strcmp(name, decCodecInfo[i].name))
+		{
+			return (Codec)i;
+		}
+	}
+	return CODEC_NONE;
+}
+
+Codec get_codec_type_from_header(const void *header) {
+    for (int i = 0; i < CODEC_MAX; i++)
+    {
+        if (!memcmp(decCodecInfo[i].header, header, 4))
+        {
+            return (Codec)i;
+        }
+    }
+    return CODEC_NONE;
+}
+
+/* decompress a file (dies if unknown codec) */
+size_t decompress(struct z64dec_ctx *ctx, void *dst, void *src, size_t sz, Codec codecOverride, Codec *codecUsed)
+{
+	Codec codecHeader;
+
+	assert(ctx != NULL);
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(sz != 0);
+
+	/* override codec if requested rather than autodetecting it */
+	if (codecOverride != CODEC_NONE)
+	{
+		/* save the used codec for the z64compress args */
+		*codecUsed = codecOverride;
+		return decCodecInfo[codecOverride].decode(ctx, src, dst, sz);
+	}
+
+	/* the codec header is the first 4 bytes of the file */
+	codecHeader = get_codec_type_from_header(src);
+
+	if (codecHeader != CODEC_NONE)
+	{
+		/* save the used codec for the z64compress args */
+		*codecUsed = codecHeader;
+		return decCodecInfo[codecHeader].decode(ctx, src, dst, sz);
+	}
+
+	die("ERROR: compressed file, unknown encoding");
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef Z64DECOMPRESS_CODEC_H_INCLUDED
+#define Z64DECOMPRESS_CODEC_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "decoder/decoder.h"
+
+typedef enum {
+	CODEC_NONE = -1,
+	CODEC_YAZ0,
+	CODEC_LZO,
+	CODEC_UCL,
+	CODEC_APLIB,
+	CODEC_ZLIB,
+	CODEC_MAX
+} Codec;
+
+typedef struct {
+	const char *name; /* name used for program args */
+	const char *header; /* identifer used in the headers of compressed files */
+	size_t (*decode)(struct z64dec_ctx *ctx, void *src, void *dst, size_t sz); /* decompression handler function */
+} CodecInfo;
+
+/* longest a codec's name is, without its terminator */
+#define CODEC_NAME_MAX 5
+
+/* every codec, indexed by Codec */
+extern const CodecInfo decCodecInfo[CODEC_MAX];
+
+/* look up a codec by the name used for program args */
+Codec get_codec_type_from_name(const char *name);
+
+/* look up a codec by the identifier at the start of a compressed file */
+Codec get_codec_type_from_header(const void *header);
+
+/* decompress a file (dies if unknown codec) */
+size_t decompress(struct z64dec_ctx *ctx, void *dst, void *src, size_t sz, Codec codecOverride, Codec *codecUsed);
+
+#endif /* Z64DECOMPRESS_CODEC_H_INCLUDED */
@@ -11,113 +11,216 @@
  * http://www.ibsensoftware.com/
  */
 
+#include "decoder.h"
 #include "private.h"
 
-struct decoder
-{
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
-	unsigned char  *buf_end;     /* pointer that exists for the sole *
-	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
-	unsigned int    remaining;   /* remaining size of file           */
-	unsigned char  *buf_limit;   /* points to end of scannable area  *
-	                              * of buf; this prevents yaz parser *
-	                              * from overflowing                 */
-#if MAJORA
-	unsigned char  *dst_end;     /* end of decompressed block        */
-#endif
-};
-
 /* internal data structure */
 struct APDSTATE {
 	unsigned char *source;
 	unsigned char *destination;
 	unsigned int tag;
-	unsigned int bitcount;
 };
 
-static struct decoder dec;
+/* the bits left in `tag` are those above its lowest set bit,
+ * excluding bit 8 and up; these tables are indexed by the low byte
+ * of `tag`, and let the runs of bits the format spends most of its
+ * time in be consumed without testing them one by one
+ */
 
-static void *refill(unsigned char *ip)
+/* number of consecutive 0 bits at the top of the tag; in the main
+ * loop, each of these is followed by a literal byte
+ */
+static const unsigned char lit_zeros[256] = {
+	0, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* how much of a gamma code can be read from the tag: the code is a
+ * series of (data, continue) bit pairs, and decoding stops at a pair
+ * that straddles two tag bytes, or at the end of the code
+ */
+struct gamma_step
+{
+	unsigned char used;  /* bits consumed                */
+	unsigned char n;     /* data bits produced           */
+	unsigned char val;   /* the data bits                */
+	unsigned char done;  /* non-zero if the code was     *
+	                      * terminated by a continue bit *
+	                      * of zero                      */
+};
+
+static const struct gamma_step gamma_steps[256] = {
+	{0,0,0,0}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{0,0,0,0}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1},
+	{4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1},
+	{2,1,0,0}, {6,3,0,1}, {6,3,0,1}, {6,3,0,1}, {4,2,0,0}, {6,3,0,0}, {6,3,0,0}, {6,3,0,0},
+	{4,2,0,0}, {6,3,1,1}, {6,3,1,1}, {6,3,1,1}, {4,2,0,0}, {6,3,1,0}, {6,3,1,0}, {6,3,1,0},
+	{2,1,0,0}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1},
+	{4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1},
+	{2,1,0,0}, {6,3,2,1}, {6,3,2,1}, {6,3,2,1}, {4,2,1,0}, {6,3,2,0}, {6,3,2,0}, {6,3,2,0},
+	{4,2,1,0}, {6,3,3,1}, {6,3,3,1}, {6,3,3,1}, {4,2,1,0}, {6,3,3,0}, {6,3,3,0}, {6,3,3,0},
+	{0,0,0,0}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{0,0,0,0}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1},
+	{4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1},
+	{2,1,1,0}, {6,3,4,1}, {6,3,4,1}, {6,3,4,1}, {4,2,2,0}, {6,3,4,0}, {6,3,4,0}, {6,3,4,0},
+	{4,2,2,0}, {6,3,5,1}, {6,3,5,1}, {6,3,5,1}, {4,2,2,0}, {6,3,5,0}, {6,3,5,0}, {6,3,5,0},
+	{2,1,1,0}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1},
+	{4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1},
+	{2,1,1,0}, {6,3,6,1}, {6,3,6,1}, {6,3,6,1}, {4,2,3,0}, {6,3,6,0}, {6,3,6,0}, {6,3,6,0},
+	{4,2,3,0}, {6,3,7,1}, {6,3,7,1}, {6,3,7,1}, {4,2,3,0}, {6,3,7,0}, {6,3,7,0}, {6,3,7,0}
+};
+
+static void *refill(struct z64dec_ctx *dec, unsigned char *ip)
 {
 	unsigned offset;
 	unsigned size;
 	
 	/* intermediate buffer is not yet due for a refill */
-	if (ip < dec.buf_end - 8)
+	if (ip < dec->buf_end - 8)
 		return ip;
 	
 	/* the number 8 is used throughout to ensure *
 	 * dma transfers are always 8 byte aligned   */
-	offset = dec.buf_end - ip;
-	size = sizeof(dec.buf) - 8;
+	offset = dec->buf_end - ip;
+	size = sizeof(dec->buf) - 8;
 	
 	/* the last eight bytes wrap around */
-	Bcopy(dec.buf_end - 8, dec.buf, 8);
+	Bcopy(dec->buf_end - 8, dec->buf, 8);
 	
 	/* transfer data from rom */
-	DMARomToRam(dec.pstart, dec.buf + 8, size);
-	dec.pstart += size;
+	DMARomToRam(dec->pstart, dec->buf + 8, size);
+	dec->pstart += size;
 	
-	return dec.buf + (8 - offset);
+	return dec->buf + (8 - offset);
 }
 
-static unsigned int aP_getbit(struct APDSTATE *ud)
+static inline unsigned int aP_getbit(struct APDSTATE *ud)
 {
-	unsigned int bit;
-
 	/* check if tag is empty */
-	if (!ud->bitcount--) {
-		/* load next tag */
-		ud->tag = *ud->source++;
-		ud->bitcount = 7;
+	if (!(ud->tag & 0x7f)) {
+		/* load next tag, with a marker bit below it */
+		ud->tag = *ud->source++ * 2 + 1;
+	}
+	else {
+		ud->tag <<= 1;
 	}
 
-	/* shift bit out of tag */
-	bit = (ud->tag >> 7) & 0x01;
-	ud->tag <<= 1;
-
-	return bit;
+	/* bit shifted out of tag */
+	return (ud->tag >> 8) & 0x01;
 }
 
-static unsigned int aP_getgamma(struct APDSTATE *ud)
+/* giving up once past `max` */
+static inline unsigned int aP_getgamma(struct APDSTATE *ud, unsigned int max)
 {
 	unsigned int result = 1;
 
-	/* input gamma2-encoded bits */
-	do {
+	/* input gamma2-encoded bits, whole pairs at a time where possible */
+	for (;;) {
+		const struct gamma_step *g = &gamma_steps[ud->tag & 0xff];
+
+		result = (result << g->n) | g->val;
+		ud->tag <<= g->used;
+
+		if (g->done || result > max) {
+			break;
+		}
+
+		/* this pair straddles two tag bytes */
 		result = (result << 1) + aP_getbit(ud);
-	} while (aP_getbit(ud));
+		if (!aP_getbit(ud)) {
+			break;
+		}
+	}
 
 	return result;
 }
 
-static inline void *aP_depack(void *source, unsigned char *destination)
+/* Z64DEC_SAFE: the input is checked before each literal run or match, *
+ * which reads no more than 40 bytes with gamma codes kept short, and   *
+ * what each one writes and where it copies from are checked with it    */
+#define SAFE_STEP \
+	if (safe && !(ud.source = safe_step(&tail, source, ud.source, &source_end))) \
+		return NULL;
+#define SAFE_GAMMA \
+	if (safe && (offs > SAFE_GAMMA_MAX || len > SAFE_GAMMA_MAX)) \
+		return NULL;
+#define SAFE_ROOM(LEN) \
+	if (safe && (LEN) > (size_t)(destination_end - destination)) \
+		return NULL;
+#define SAFE_COPY(OFFS, LEN) \
+	SAFE_ROOM(LEN) \
+	if (safe && (OFFS) - 1 >= (size_t)(destination - _destination)) \
+		return NULL;
+
+/* `flat` is non-zero if source is the whole file rather than `buf`, *
+ * and `safe` if it is also `sz` bytes that can't be trusted; returns *
+ * NULL if it isn't a valid file                                      */
+static inline void *aP_depack(struct z64dec_ctx *dec, unsigned char *source, unsigned char *destination, const int flat, const int safe, size_t sz)
 {
+	const unsigned int gamma_max = safe ? SAFE_GAMMA_MAX : ~0u;
+	unsigned char *_destination = destination;
+	unsigned char *destination_end = destination;
+	unsigned char *source_end = source + (safe ? sz : 0);
+	struct safe_tail tail;
 	struct APDSTATE ud;
 	unsigned int offs, len, R0, LWM;
 	int done;
 	int i;
 
 	ud.source = source;
-	ud.bitcount = 0;
+	ud.tag = 0;
+	tail.from = NULL;
+	if (safe)
+		destination_end += safe_room(dec, source, sz);
 
 	R0 = (unsigned int) -1;
 	LWM = 0;
 	done = 0;
 	
 	/* initial buffer fill */
-	ud.source = refill(ud.source);
+	if (!flat)
+		ud.source = refill(dec, ud.source);
 	
 	/* skip header */
 	ud.source += 8;
 
 	/* first byte verbatim */
+	SAFE_ROOM(1)
 	*destination++ = *ud.source++;
 
 	/* main decompression loop */
 	while (!done) {
-		ud.source = refill(ud.source);
+		if (!flat)
+			ud.source = refill(dec, ud.source);
+		SAFE_STEP
 		if (aP_getbit(&ud)) {
 			if (aP_getbit(&ud)) {
 				if (aP_getbit(&ud)) {
@@ -128,10 +231,12 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 					}
 
 					if (offs) {
+						SAFE_COPY(offs, 1)
 						*destination = *(destination - offs);
 						destination++;
 					}
 					else {
+						SAFE_ROOM(1)
 						*destination++ = 0x00;
 					}
 
@@ -145,10 +250,8 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 					offs >>= 1;
 
 					if (offs) {
-						for (; len; len--) {
-							*destination = *(destination - offs);
-							destination++;
-						}
+						SAFE_COPY(offs, len)
+						destination = match_copy(destination, destination - offs, len);
 					}
 					else {
 						done = 1;
@@ -159,17 +262,18 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 				}
 			}
 			else {
-				offs = aP_getgamma(&ud);
+				offs = aP_getgamma(&ud, gamma_max);
+				len = 0;
+				SAFE_GAMMA
 
 				if ((LWM == 0) && (offs == 2)) {
 					offs = R0;
 
-					len = aP_getgamma(&ud);
+					len = aP_getgamma(&ud, gamma_max);
+					SAFE_GAMMA
 
-					for (; len; len--) {
-						*destination = *(destination - offs);
-						destination++;
-					}
+					SAFE_COPY(offs, len)
+					destination = match_copy(destination, destination - offs, len);
 				}
 				else {
 					if (LWM == 0) {
@@ -182,7 +286,7 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 					offs <<= 8;
 					offs += *ud.source++;
 
-					len = aP_getgamma(&ud);
+					len = aP_getgamma(&ud, gamma_max);
 
 					if (offs >= 32000) {
 						len++;
@@ -194,10 +298,8 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 						len += 2;
 					}
 
-					for (; len; len--) {
-						*destination = *(destination - offs);
-						destination++;
-					}
+					SAFE_COPY(offs, len)
+					destination = match_copy(destination, destination - offs, len);
 
 					R0 = offs;
 				}
@@ -206,28 +308,68 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 			}
 		}
 		else {
-			*destination++ = *ud.source++;
+			/* this literal, and any that directly follow it */
+			len = lit_zeros[ud.tag & 0xff] + 1;
+			ud.tag <<= len - 1;
+			SAFE_ROOM(len)
+
+			for (i = 0; i < (int)len; i++) {
+				destination[i] = ud.source[i];
+			}
+			destination += len;
+			ud.source += len;
+
 			LWM = 0;
 		}
 	}
 	
+	/* the end marker may have gone on past the end */
+	if (safe && ud.source > source_end)
+		return NULL;
+	
+	if (flat)
+		dec->src_end = safe ? safe_input(&tail, ud.source) : ud.source;
+	
 	return destination;
 }
 
 /* main driver */
-size_t apldec(void *src, void *_dst, size_t sz)
+size_t apldec_ctx(struct z64dec_ctx *dec, void *src, void *_dst, size_t sz)
 {
 	unsigned char* dst = _dst;
 	
-	dec.pstart = src;
-	dec.buf_end = dec.buf + sizeof(dec.buf);
-	dst = aP_depack(dec.buf_end, dst);
-	(void)sz; /* unused parameter */
+	/* read directly from the file, it is already in memory */
+	if (dec->flags & Z64DEC_FLAT)
+	{
+		/* too small to hold a header and the first byte */
+		if (sz < 8 + 1)
+			return 0;
+		
+		if (dec->flags & Z64DEC_SAFE)
+		{
+			if (!(dst = aP_depack(dec, src, dst, 1, 1, sz)))
+				return 0;
+		}
+		else
+			dst = aP_depack(dec, src, dst, 1, 0, sz);
+		return dst - (unsigned char*)_dst;
+	}
+	
+	dec->pstart = src;
+	dec->buf_end = dec->buf + sizeof(dec->buf);
+	dst = aP_depack(dec, dec->buf_end, dst, 0, 0, sz);
 #if MAJORA
-	dec.dst_end = dst;
-	dec.buf_end = 0;
+	dec->dst_end = dst;
+	dec->buf_end = 0;
 #endif
 	/* get the final decompressed size */
 	return dst - (unsigned char*)_dst;
 }
 
+/* main driver, using a shared context */
+size_t apldec(void *src, void *dst, size_t sz)
+{
+	static struct z64dec_ctx ctx;
+	
+	return apldec_ctx(&ctx, src, dst, sz);
+}
@@ -1,6 +1,82 @@
 #ifndef Z64DECOMPRESS_DECODER_H_INCLUDED
 #define Z64DECOMPRESS_DECODER_H_INCLUDED
 
+#include <stddef.h> /* size_t */
+
+/* decoder state; each thread needs its own in order to decode in *
+ * parallel, and one can be reused across any number of files     */
+struct z64dec_ctx
+{
+	unsigned char   buf[1024];   /* intermediate buffer for loading  */
+	unsigned char  *buf_end;     /* pointer that exists for the sole *
+	                              * purpose of getting size of `buf` */
+	unsigned char  *pstart;      /* offset of next read from rom     */
+	unsigned int    remaining;   /* remaining size of file           */
+	unsigned char  *buf_limit;   /* points to end of scannable area  *
+	                              * of buf; this prevents yaz parser *
+	                              * from overflowing                 */
+	unsigned int    bb;          /* ucl: bit buffer                  */
+	unsigned int    ilen;        /* ucl: bytes processed in `buf`    */
+	unsigned int    flags;       /* any combination of Z64DEC_*      */
+	size_t          dst_max;     /* room at dst, or 0 if unknown     */
+	unsigned char  *src_end;     /* flat: end of what the last file  *
+	                              * read from src, or NULL if the    *
+	                              * decoder never reads past `sz`    */
+#if MAJORA
+	unsigned char  *dst_end;     /* end of decompressed block        */
+#endif
+};
+
+/* z64dec_ctx.flags */
+#define Z64DEC_FLAT  (1 << 0) /* the whole compressed file is in host  *
+                               * memory, so read it directly instead  *
+                               * of emulating dma transfers via `buf` */
+#define Z64DEC_SAFE  (1 << 1) /* with Z64DEC_FLAT, the file may be     *
+                               * corrupt: never read past `sz` bytes  *
+                               * of src or write past dst_max bytes   *
+                               * of dst (or the size in the header if *
+                               * dst_max is 0), and return 0 instead  *
+                               * of decoding a file that would        */
+
+/* prepare a context for first use */
+static inline void z64dec_ctx_init(struct z64dec_ctx *ctx, unsigned flags)
+{
+	ctx->flags = flags;
+	ctx->dst_max = 0;
+}
+
+/* decompressed size stored in a file's 8-byte header, which every *
+ * codec lays out as a 4-byte identifier followed by a big-endian  *
+ * size; returns 0 if the file is too small to have a header       */
+static inline size_t z64dec_header_size(const void *src, size_t sz)
+{
+	const unsigned char *b = src;
+	
+	if (sz < 8)
+		return 0;
+	
+	return ((size_t)b[4] << 24) | (b[5] << 16) | (b[6] << 8) | b[7];
+}
+
+/* receives each chunk of output from a streaming decoder; returns *
+ * non-zero to stop decoding early                                 */
+typedef int (*z64dec_write_fn)(void *udata, const void *data, size_t sz);
+
+/* reentrant decoders */
+size_t yazdec_ctx(struct z64dec_ctx *ctx, void *src, void *dst, size_t sz);
+size_t lzodec_ctx(struct z64dec_ctx *ctx, void *src, void *dst, size_t sz);
+size_t ucldec_ctx(struct z64dec_ctx *ctx, void *src, void *dst, size_t sz);
+size_t apldec_ctx(struct z64dec_ctx *ctx, void *src, void *dst, size_t sz);
+size_t zlibdec_ctx(struct z64dec_ctx *ctx, void *src, void *dst, size_t sz);
+
+/* streaming decoders, which hand the output to `write` in chunks *
+ * rather than needing a buffer the size of the whole file; they  *
+ * return the number of bytes handed to `write`, or 0 if they run *
+ * out of memory or Z64DEC_SAFE finds the file is corrupt, which  *
+ * may be after some of it has been handed off                    */
+size_t yazdec_stream(struct z64dec_ctx *ctx, void *src, size_t sz, z64dec_write_fn write, void *udata);
+
+/* the same decoders sharing one static context (not reentrant) */
 size_t yazdec(void *src, void *dst, size_t sz);
 size_t lzodec(void *src, void *dst, size_t sz);
 size_t ucldec(void *src, void *dst, size_t sz);
@@ -8,4 +84,3 @@ size_t apldec(void *src, void *dst, size_t sz);
 size_t zlibdec(void *src, void *dst, size_t sz);
 
 #endif /* Z64DECOMPRESS_DECODER_H_INCLUDED */
-
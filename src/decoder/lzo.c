@@ -1,5 +1,6 @@
 /* <z64.me> adapted from lzo1x_d.ch */
 
+#include "decoder.h"
 #include "private.h"
 
 /* negative indexing distance */
@@ -8,98 +9,108 @@
 /* lzo max negative offset */
 #define M2_MAX_OFFSET   0x0800
 
-struct decoder
-{
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
-	unsigned char  *buf_end;     /* pointer that exists for the sole *
-	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
-	unsigned int    remaining;   /* remaining size of file           */
-	unsigned char  *buf_limit;   /* points to end of scannable area  *
-	                              * of buf; this prevents yaz parser *
-	                              * from overflowing                 */
-#if MAJORA
-	unsigned char  *dst_end;     /* end of decompressed block        */
-#endif
-};
-
-static struct decoder dec;
-
-/* block copy, with desired overlapping behavior */
-static void *ocopy(void *_src, void *_dst, unsigned n)
-{
-	unsigned char *src = _src;
-	unsigned char *dst = _dst;
-	
-	do *dst++ = *src++; while (--n);
-	
-	return dst;
-}
-
 /* refill intermediate buffer if necessary */
-static unsigned char *refill(unsigned char *ip)
+static unsigned char *refill(struct z64dec_ctx *dec, unsigned char *ip)
 {
 	unsigned offset;
 	unsigned size;
 	int      align;
 	
 	/* intermediate buffer is not yet due for a refill */
-	if (ip < dec.buf_end - 32)
+	if (ip < dec->buf_end - 32)
 		return ip;
 	
 	ip -= NINDEX;
 	
 	/* the weird alignment stuff ensures dma *
 	 * transfers are always 8 byte aligned   */
-	offset = dec.buf_end - ip;
+	offset = dec->buf_end - ip;
 	align = 8 - (offset & 7);
 	offset += align;
-	size = sizeof(dec.buf) - offset;
+	size = sizeof(dec->buf) - offset;
 	
 	/* the last bytes wrap around */
-	ocopy(dec.buf_end - offset, dec.buf, offset);
-	ip = dec.buf + align + NINDEX;
+	Bcopy(dec->buf_end - offset, dec->buf, offset);
+	ip = dec->buf + align + NINDEX;
 	
 	/* transfer data from rom */
-	DMARomToRam(dec.pstart, dec.buf + offset, size);
-	dec.pstart += size;
+	DMARomToRam(dec->pstart, dec->buf + offset, size);
+	dec->pstart += size;
 	
 	return ip;
 }
 
 
-/* main driver */
-size_t lzodec(void *_src, void *_dst, size_t sz)
+/* Z64DEC_SAFE: the checks decompress() makes; a token reads a few  *
+ * bytes and a length, so the input is checked between tokens, and  *
+ * copies and the length bytes (each worth 255 more) are checked as *
+ * they go                                                          */
+#define SAFE_STEP \
+	if (safe && !(ip = safe_step(&tail, pstart, ip, &ip_end))) \
+		return 0;
+#define SAFE_ZERO \
+	SAFE_STEP \
+	if (safe && (size_t)t > (size_t)(op_end - op)) \
+		return 0;
+#define SAFE_COPY(N) \
+	if (safe && (size_t)(N) > (size_t)(op_end - op)) \
+		return 0;
+#define SAFE_LITERALS(N) \
+	if (safe && ((size_t)(N) > (size_t)(op_end - op) \
+		|| (size_t)(N) > (size_t)(ip_end - ip))) \
+		return 0;
+#define SAFE_MATCH(N) \
+	if (safe && (m_pos < (unsigned char*)_dst \
+		|| (size_t)(N) > (size_t)(op_end - op))) \
+		return 0;
+
+/* decompress lzo data; `flat` is non-zero if _src is the whole file, *
+ * and `safe` if it is also `sz` bytes that can't be trusted           */
+static inline size_t decompress(struct z64dec_ctx *dec, void *_src, void *_dst, const int flat, const int safe, size_t sz)
 {
 	unsigned char *pstart = _src;
 	unsigned char *op = _dst;
 	unsigned char *m_pos;
 	unsigned char *ip;
+	unsigned char *ip_end = pstart + sz;
+	unsigned char *op_end = op;
+	struct safe_tail tail;
 	int t;
-	(void)sz; /* unused parameter */
 	
-	dec.pstart = pstart;
-	dec.buf_end = dec.buf + sizeof(dec.buf);
-	ip = dec.buf_end;
+	tail.from = NULL;
+	if (safe)
+		op_end += safe_room(dec, _src, sz);
 	
-	/* initial buffer fill */
-	ip = refill(ip);
+	if (flat)
+		ip = pstart;
+	else
+	{
+		dec->pstart = pstart;
+		dec->buf_end = dec->buf + sizeof(dec->buf);
+		ip = dec->buf_end;
+		
+		/* initial buffer fill */
+		ip = refill(dec, ip);
+	}
 	
 	/* skip header */
 	ip += 8;
 	
+	SAFE_STEP
 	if (*ip > 17)
 	{
 		t = *ip++ - 17;
 		if (t < 4)
 			goto match_next;
-		op = ocopy(ip, op, t);
+		SAFE_LITERALS(t)
+		op = lit_copy(op, ip, t);
 		ip += t;
 		goto first_literal_run;
 	}
 	
 	for (;;)
 	{
+		SAFE_STEP
 		t = *ip++;
 		if (t >= 16)
 			goto match;
@@ -110,23 +121,33 @@ size_t lzodec(void *_src, void *_dst, size_t sz)
 			{
 				t += 255;
 				ip++;
+				SAFE_ZERO
 			}
 			t += 15 + *ip++;
 		}
 		/* copy literals */
+		if (flat)
+		{
+			t += 3;
+			SAFE_LITERALS(t)
+			op = lit_copy(op, ip, t);
+			ip += t;
+		}
+		else
 		{
 			t += 3;
 			/* this loop can advance any number of bytes (4k+) */
 			do
 			{
 				/* ensure buffer contains data */
-				ip = refill(ip);
+				ip = refill(dec, ip);
 				
 				*op++ = *ip++;
 			} while (--t);
 		}
 		
 first_literal_run:
+		SAFE_STEP
 		t = *ip++;
 		if (t >= 16)
 			goto match;
@@ -135,7 +156,8 @@ first_literal_run:
 		m_pos -= ip[0] << 2;
 		ip++;
 		
-		op = ocopy(m_pos, op, 3);
+		SAFE_MATCH(3)
+		op = match_copy(op, m_pos, 3);
 		goto match_done;
 
 		/* handle matches */
@@ -161,6 +183,7 @@ match:
 					{
 						t += 255;
 						ip++;
+						SAFE_ZERO
 					}
 					t += 31 + *ip++;
 				}
@@ -180,6 +203,7 @@ match:
 					{
 						t += 255;
 						ip++;
+						SAFE_ZERO
 					}
 					t += 7 + *ip++;
 				}
@@ -195,18 +219,22 @@ match:
 				m_pos -= t >> 2;
 				m_pos -= ip[0] << 2;
 				ip += 1;
-				op = ocopy(m_pos, op, 2);
+				SAFE_MATCH(2)
+				op = match_copy(op, m_pos, 2);
 				goto match_done;
 			}
 
 			/* copy match */
 			t += 2;
-			op = ocopy(m_pos, op, t);
+			SAFE_MATCH(t)
+			op = match_copy(op, m_pos, t);
 
 
 match_done:
 			/* ensure buffer contains data */
-			ip = refill(ip);
+			if (!flat)
+				ip = refill(dec, ip);
+			SAFE_STEP
 			t = ip[-NINDEX] & 3;
 			if (t == 0)
 				break;
@@ -214,17 +242,48 @@ match_done:
 			/* copy literals */
 			/* this never advances more than 4 bytes */
 match_next:
-			op = ocopy(ip, op, t);
+			SAFE_COPY(t)
+			op = lit_copy(op, ip, t);
 			ip += t;
 			t = *ip++;
 		}
 	}
 L_done: do{}while(0);	
+	/* the end marker is the last thing in the file */
+	if (safe && ip_end - ip < 2)
+		return 0;
+	if (flat)
+		dec->src_end = safe ? safe_input(&tail, ip) + 2 : ip + 2;
 #if MAJORA
-	dec.dst_end = op;
-	dec.buf_end = 0;
+	dec->dst_end = op;
+	dec->buf_end = 0;
 #endif
 
 	return op - (unsigned char*)_dst;
 }
 
+/* main driver */
+size_t lzodec_ctx(struct z64dec_ctx *dec, void *src, void *dst, size_t sz)
+{
+	/* read directly from the file, it is already in memory */
+	if (dec->flags & Z64DEC_FLAT)
+	{
+		/* too small to hold a header and an end marker */
+		if (sz < 8 + 3)
+			return 0;
+		
+		if (dec->flags & Z64DEC_SAFE)
+			return decompress(dec, src, dst, 1, 1, sz);
+		return decompress(dec, src, dst, 1, 0, sz);
+	}
+	
+	return decompress(dec, src, dst, 0, 0, sz);
+}
+
+/* main driver, using a shared context */
+size_t lzodec(void *src, void *dst, size_t sz)
+{
+	static struct z64dec_ctx ctx;
+	
+	return lzodec_ctx(&ctx, src, dst, sz);
+}
@@ -1,7 +1,16 @@
 #ifndef Z64DECOMPRESS_DECODER_PRIVATE_H_INCLUDED
 #define Z64DECOMPRESS_DECODER_PRIVATE_H_INCLUDED
 
-#include <string.h> /* memcpy */
+#include <stddef.h> /* size_t */
+#include <string.h> /* memcpy, memset */
+
+#include "decoder.h"
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
 
 #define Bcopy(SRC, DST, LEN) memcpy(DST, SRC, LEN)
 #define DMARomToRam(SRC, DST, LEN) memcpy(DST, SRC, LEN)
@@ -9,7 +18,196 @@
 /* XXX casting like *(unsigned int*) is used in n64 code but
  *     that assumes a big-endian build target; adapt to BE32()
  */
-#define BE32(X) ( ((X)[0]<<24) | ((X)[1]<<16) | ((X)[2]<<8) | (X)[3] )
+#define BE32(X) ( ((unsigned)(X)[0]<<24) | ((X)[1]<<16) | ((X)[2]<<8) | (X)[3] )
+
+/* copy 16 bytes that do not overlap */
+static inline void copy16(unsigned char *dst, const unsigned char *src)
+{
+#if defined(__SSE2__)
+	_mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+#elif defined(__ARM_NEON)
+	vst1q_u8(dst, vld1q_u8(src));
+#else
+	memcpy(dst, src, 16);
+#endif
+}
+
+/* copy 8 bytes that do not overlap (a single 64-bit move) */
+static inline void copy8(unsigned char *dst, const unsigned char *src)
+{
+	memcpy(dst, src, 8);
+}
+
+/* copy `n` bytes of literal data, which never overlaps the output;
+ * returns dst + n
+ */
+static inline unsigned char *lit_copy(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	memcpy(dst, src, n);
+	
+	return dst + n;
+}
+
+/* copy an `n` byte back-reference from `src`, which is behind `dst`
+ * and may overlap it, in which case the bytes between them repeat;
+ * nothing past dst + n is written; returns dst + n
+ */
+static inline unsigned char *match_copy(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	size_t dist = dst - src;
+	
+	/* distance covers a whole word */
+	if (dist >= 8)
+	{
+		while (n >= 8)
+		{
+			copy8(dst, src);
+			dst += 8;
+			src += 8;
+			n -= 8;
+		}
+	}
+	
+	/* run of a single byte */
+	else if (dist == 1)
+	{
+		memset(dst, *src, n);
+		return dst + n;
+	}
+	
+	/* short repeating pattern: build 16 bytes of it, then splat
+	 * that, stepping by a multiple of the distance so the phase of
+	 * the pattern is retained from one store to the next (a corrupt
+	 * file can give a distance of 0, which is left to the byte loop)
+	 */
+	else if (n >= 16 && dist)
+	{
+		unsigned char pat[16];
+		size_t step = 16 - 16 % dist;
+		size_t len;
+		
+		memcpy(pat, src, dist);
+		for (len = dist; len < 16; len *= 2)
+			memcpy(pat + len, pat, len < 16 - len ? len : 16 - len);
+		
+		while (n >= 16)
+		{
+			memcpy(dst, pat, 16);
+			dst += step;
+			n -= step;
+		}
+		memcpy(dst, pat, n);
+		return dst + n;
+	}
+	
+	/* whatever is left, a byte at a time */
+	while (n)
+	{
+		*dst++ = *src++;
+		n -= 1;
+	}
+	
+	return dst;
+}
+
+/* match_copy() for decoders that know where their output ends; `room`
+ * is the number of bytes left in the output, which may be written up
+ * to one chunk past the end of the match (decoding overwrites those
+ * bytes later anyway), so most matches take only a store or two
+ */
+static inline unsigned char *match_copy_fast(unsigned char *dst, const unsigned char *src, size_t n, size_t room)
+{
+	size_t dist = dst - src;
+	unsigned char *end = dst + n;
+	
+	/* distance covers a whole 16-byte chunk */
+	if (dist >= 16 && room >= n + 15)
+	{
+		do
+		{
+			copy16(dst, src);
+			dst += 16;
+			src += 16;
+		} while (dst < end);
+		return end;
+	}
+	
+	/* distance covers a whole 8-byte chunk */
+	if (dist >= 8 && room >= n + 7)
+	{
+		do
+		{
+			copy8(dst, src);
+			dst += 8;
+			src += 8;
+		} while (dst < end);
+		return end;
+	}
+	
+	return match_copy(dst, src, n);
+}
+
+/* Z64DEC_SAFE: between steps (a code byte, a token), decoders check
+ * whether they are within SAFE_SLACK bytes of the end of the input,
+ * which is more than any step reads but the lengths it checks itself;
+ * until then nothing a step reads needs checking, and once there, what
+ * is left is moved to a zero-padded tail, so a step that goes past the
+ * end reads zeroes instead, and is caught by the next check
+ */
+#define SAFE_SLACK      64
+#define SAFE_BEHIND     8          /* bytes kept ahead of the tail, for *
+                                    * decoders that look back at input  */
+#define SAFE_GAMMA_MAX  0x2000000  /* gamma codes longer than this stop */
+
+struct safe_tail
+{
+	unsigned char   buf[SAFE_BEHIND + SAFE_SLACK * 2];
+	unsigned char  *from;      /* where buf + SAFE_BEHIND was copied from, *
+	                            * or NULL if decoding isn't there yet      */
+	unsigned char  *end;       /* end of the input within buf */
+};
+
+/* the check a decoder makes between steps, reading from `p` next in an
+ * input that starts at `start` and ends at *end; returns where to read
+ * from instead, which is in the tail once there, or NULL if the last
+ * step read past the end
+ */
+static inline unsigned char *safe_step(struct safe_tail *t, unsigned char *start, unsigned char *p, unsigned char **end)
+{
+	size_t behind;
+	
+	if (*end - p >= SAFE_SLACK)
+		return p;
+	if (p > *end)
+		return NULL;
+	if (t->from)
+		return p;
+	
+	behind = p - start < SAFE_BEHIND ? (size_t)(p - start) : SAFE_BEHIND;
+	memset(t->buf, 0, sizeof(t->buf));
+	memcpy(t->buf + SAFE_BEHIND - behind, p - behind, behind + (*end - p));
+	t->from = p;
+	t->end = t->buf + SAFE_BEHIND + (*end - p);
+	*end = t->end;
+	
+	return t->buf + SAFE_BEHIND;
+}
+
+/* where `p` is in the input, once decoding may have moved to the tail */
+static inline unsigned char *safe_input(const struct safe_tail *t, unsigned char *p)
+{
+	if (t->from)
+		return t->from + (p - (t->buf + SAFE_BEHIND));
+	
+	return p;
+}
+
+/* Z64DEC_SAFE: room for the output, which is dst_max if given, *
+ * otherwise the size in the header                             */
+static inline size_t safe_room(const struct z64dec_ctx *dec, const void *src, size_t sz)
+{
+	return dec->dst_max ? dec->dst_max : z64dec_header_size(src, sz);
+}
 
 #endif /* Z64DECOMPRESS_DECODER_PRIVATE_H_INCLUDED */
 
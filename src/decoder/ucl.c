@@ -1,46 +1,142 @@
 /* <z64.me> ucl decompression using intermediate buffer */
 
+#include "decoder.h"
 #include "private.h"
 
-struct decoder
-{
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
-	unsigned int    bb;          /* ucl: bit buffer                  */
-	unsigned char  *pstart;      /* offset of next read from rom     */
-	unsigned int    remaining;   /* compressed bytes not yet read    */
-	unsigned int    ilen;        /* ucl: bytes processed in `buf`    */
-#if MAJORA
-	unsigned char  *dst_end;     /* end of decompressed block        */
-#endif
-};
-
-static struct decoder dec;
-
 /* these are used often, so shorten their names with a macro */
-#define ilen   dec.ilen
-#define bb     dec.bb
+#define ilen   dec->ilen
+#define bb     dec->bb
 
 /* get next bit in bit buffer */
-#define getbit(bb) getbit_dma()
+#define getbit(bb) getbit_dma(dec)
 
 /* unsafe, inline version of above, for speed */
 #define getbit_unsafe(bb) \
 	(((bb = bb & 0x7f \
 		? (unsigned)(bb*2) \
-		: (unsigned)(dec.buf[ilen++]*2+1) \
+		: (unsigned)(dec->buf[ilen++]*2+1) \
 	) >> 8) & 1)
 
 /* function version of above, for saving bytes in final binary */
-#define getbit_unsafe_F(bb) getbit_dma_unsafe()
+#define getbit_unsafe_F(bb) getbit_dma_unsafe(dec)
+
+/* the bits left in the bit buffer are those above its lowest set
+ * bit, excluding bit 8 and up; these tables are indexed by the low
+ * byte of the bit buffer, and let the runs of bits the format spends
+ * most of its time in be consumed without testing them one by one
+ */
+
+/* number of consecutive 1 bits at the top of the bit buffer; in a
+ * run of literals, each of these is followed by a literal byte
+ */
+static const unsigned char lit_ones[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 7
+};
+
+/* how much of a gamma code can be read from the bit buffer: the
+ * code is a series of (data, stop) bit pairs, and decoding stops at a
+ * pair that straddles two control bytes, or at the end of the code
+ */
+struct gamma_step
+{
+	unsigned char used;  /* bits consumed                */
+	unsigned char n;     /* data bits produced           */
+	unsigned char val;   /* the data bits                */
+	unsigned char done;  /* non-zero if the code was     *
+	                      * terminated by a stop bit     */
+};
+
+static const struct gamma_step gamma_steps[256] = {
+	{0,0,0,0}, {6,3,0,0}, {6,3,0,0}, {6,3,0,0}, {4,2,0,0}, {6,3,0,1}, {6,3,0,1}, {6,3,0,1},
+	{4,2,0,0}, {6,3,1,0}, {6,3,1,0}, {6,3,1,0}, {4,2,0,0}, {6,3,1,1}, {6,3,1,1}, {6,3,1,1},
+	{2,1,0,0}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1},
+	{4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1}, {4,2,0,1},
+	{2,1,0,0}, {6,3,2,0}, {6,3,2,0}, {6,3,2,0}, {4,2,1,0}, {6,3,2,1}, {6,3,2,1}, {6,3,2,1},
+	{4,2,1,0}, {6,3,3,0}, {6,3,3,0}, {6,3,3,0}, {4,2,1,0}, {6,3,3,1}, {6,3,3,1}, {6,3,3,1},
+	{2,1,0,0}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1},
+	{4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1}, {4,2,1,1},
+	{0,0,0,0}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1}, {2,1,0,1},
+	{0,0,0,0}, {6,3,4,0}, {6,3,4,0}, {6,3,4,0}, {4,2,2,0}, {6,3,4,1}, {6,3,4,1}, {6,3,4,1},
+	{4,2,2,0}, {6,3,5,0}, {6,3,5,0}, {6,3,5,0}, {4,2,2,0}, {6,3,5,1}, {6,3,5,1}, {6,3,5,1},
+	{2,1,1,0}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1},
+	{4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1}, {4,2,2,1},
+	{2,1,1,0}, {6,3,6,0}, {6,3,6,0}, {6,3,6,0}, {4,2,3,0}, {6,3,6,1}, {6,3,6,1}, {6,3,6,1},
+	{4,2,3,0}, {6,3,7,0}, {6,3,7,0}, {6,3,7,0}, {4,2,3,0}, {6,3,7,1}, {6,3,7,1}, {6,3,7,1},
+	{2,1,1,0}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1},
+	{4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1}, {4,2,3,1},
+	{0,0,0,0}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1},
+	{2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}, {2,1,1,1}
+};
+
+/* copy a run of literals, as many at a time as the bit buffer allows; *
+ * CHECK comes before each group of them                               */
+#define copy_literals(SRC, GETBIT, CHECK) \
+	while (GETBIT(bb)) \
+	{ \
+		unsigned int n = lit_ones[bb & 0xff]; \
+		const unsigned char *lit; \
+		unsigned int i; \
+		CHECK \
+		lit = (SRC) + ilen; \
+		bb <<= n; \
+		ilen += n + 1; \
+		for (i = 0; i <= n; ++i) \
+			dst[i] = lit[i]; \
+		dst += n + 1; \
+	}
+
+/* continue decoding the gamma code `V`, a pair that straddles two *
+ * control bytes at a time being decoded using GETBIT, giving up   *
+ * once it's past MAX                                              */
+#define getgamma(V, GETBIT, MAX) \
+	for (;;) \
+	{ \
+		const struct gamma_step *g = &gamma_steps[bb & 0xff]; \
+		V = (V << g->n) | g->val; \
+		bb <<= g->used; \
+		if (g->done || V > (MAX)) \
+			break; \
+		V = V*2 + GETBIT(bb); \
+		if (GETBIT(bb)) \
+			break; \
+	}
 
 /* refill intermediate buffer if needed, and return new bit buffer */
-static inline unsigned int refill(void)
+static inline unsigned int refill(struct z64dec_ctx *dec)
 {
 	/* if we have exceeded the intermediate buffer, refill it */
-	if (ilen >= sizeof(dec.buf) - 32)
+	if (ilen >= sizeof(dec->buf) - 32)
 	{
-		unsigned size = sizeof(dec.buf);
-		int offset = sizeof(dec.buf) - ilen;
+		unsigned size = sizeof(dec->buf);
+		int offset = sizeof(dec->buf) - ilen;
 		int Nilen;
 		
 		/* bcopy src and dst must be aligned */
@@ -51,29 +147,29 @@ static inline unsigned int refill(void)
 		if (offset)
 		{
 			size -= offset + Nilen;
-			Bcopy(dec.buf + ilen, dec.buf + Nilen, offset);
+			Bcopy(dec->buf + ilen, dec->buf + Nilen, offset);
 		}
 		ilen = Nilen;
 		
 		/* if it exceeds remaining file size, use that */
-		if (dec.remaining < size)
-			size = dec.remaining;
+		if (dec->remaining < size)
+			size = dec->remaining;
 		
 		/* read file from rom */
 		if (size != 0)
 		{
-			DMARomToRam(dec.pstart, dec.buf + offset + Nilen, size);
+			DMARomToRam(dec->pstart, dec->buf + offset + Nilen, size);
 			
-			dec.pstart += size;
-			dec.remaining -= size;
+			dec->pstart += size;
+			dec->remaining -= size;
 		}
 	}
 	
-	return dec.buf[(ilen)++];
+	return dec->buf[(ilen)++];
 }
 
 /* get next bit in bit buffer */
-static int getbit_dma(void)
+static int getbit_dma(struct z64dec_ctx *dec)
 {
 	if (bb & 0x7f)
 	{
@@ -83,13 +179,13 @@ static int getbit_dma(void)
 //		goto early;
 	}
 	
-	bb = refill() * 2 + 1;
+	bb = refill(dec) * 2 + 1;
 //early:
 	return (bb >> 8) & 1;
 }
 
 /* unsafe version of above, for speed */
-static int (getbit_dma_unsafe)(void)
+static int (getbit_dma_unsafe)(struct z64dec_ctx *dec)
 {
 	if (bb & 0x7f)
 	{
@@ -99,46 +195,43 @@ static int (getbit_dma_unsafe)(void)
 //		goto early;
 	}
 	
-	bb = dec.buf[(ilen)++] * 2 + 1;
+	bb = dec->buf[(ilen)++] * 2 + 1;
 //early:
 	return (bb >> 8) & 1;
 }
 
 /* adapted from ucl/n2b_d.c */
-size_t ucldec(void *_src, void *_dst, size_t sz)
+static inline size_t decompress_dma(struct z64dec_ctx *dec, void *_src, void *_dst, size_t sz)
 {
 	unsigned char *pstart = _src;
 	unsigned char *dst = _dst;
-	int last_m_off = 1;
+	unsigned int last_m_off = 1;
 	
 	/* skip the 8-byte header */
 	pstart += 8;
 	sz -= 8;
 	
 	/* initialize decoder structure */
-	dec.pstart = pstart;
-	dec.remaining = sz;
+	dec->pstart = pstart;
+	dec->remaining = sz;
 	bb = 0;
-	ilen = sizeof(dec.buf);
+	ilen = sizeof(dec->buf);
 
 	for (;;)
 	{
-		int m_off;
-		int m_len;
+		unsigned int m_off;
+		unsigned int m_len;
 
-		while (getbit(bb))
-			*dst++ = dec.buf[ilen++];
+		copy_literals(dec->buf, getbit, )
 		
 		m_off = 1;
-		do {
-			m_off = m_off*2 + getbit(bb);
-		} while (!getbit(bb));
+		getgamma(m_off, getbit, ~0u)
 		if (m_off == 2)
 			m_off = last_m_off;
 		else
 		{
-			m_off = (m_off-3)*256 + dec.buf[ilen++];
-			if (m_off == -1)
+			m_off = (m_off-3)*256 + dec->buf[ilen++];
+			if (m_off == 0xffffffff)
 				break;
 			last_m_off = ++m_off;
 		}
@@ -147,10 +240,8 @@ size_t ucldec(void *_src, void *_dst, size_t sz)
 		m_len = m_len*2 + getbit_unsafe_F(bb);
 		if (m_len == 0)
 		{
-			m_len++;
-			do {
-				m_len = m_len*2 + getbit_unsafe_F(bb);
-			} while (!getbit_unsafe_F(bb));
+			m_len = 1;
+			getgamma(m_len, getbit_unsafe_F, ~0u)
 			m_len += 2;
 		}
 		m_len += (m_off > 0xd00);
@@ -159,35 +250,12 @@ size_t ucldec(void *_src, void *_dst, size_t sz)
 			m_pos = dst - m_off;
 			m_len += 1;
 			
-#if 0
-			do *dst++ = *m_pos++; while (--m_len);
-#else
-		/* NOTE the unrolled variant below is 10% faster on Wii VC */
-			
-			/* get remaining bytes to a multiple of 4 */
-			while (m_len & 3)
-			{
-				*dst++ = *m_pos++;
-				m_len -= 1;
-			}
-			
-			/* transfer remaining block four bytes at a time */
-			while (m_len)
-			{
-				dst[0] = m_pos[0];
-				dst[1] = m_pos[1];
-				dst[2] = m_pos[2];
-				dst[3] = m_pos[3];
-				m_pos += 4;
-				m_len -= 4;
-				dst += 4;
-			}
-#endif /* unrolled variant */
+			dst = match_copy(dst, m_pos, m_len);
 		}
 	}
 	
 #if MAJORA
-	dec.dst_end = dst;
+	dec->dst_end = dst;
 	bb = 0;
 #endif
 
@@ -195,3 +263,127 @@ size_t ucldec(void *_src, void *_dst, size_t sz)
 	return dst - (unsigned char*)_dst;
 }
 
+/* the flat decoder keeps its state in locals rather than `dec` */
+#undef ilen
+#undef bb
+
+/* get next bit in bit buffer, reading straight from the file */
+#define getbit_flat(bb) \
+	(((bb = bb & 0x7f \
+		? (unsigned)(bb*2) \
+		: (unsigned)(src[ilen++]*2+1) \
+	) >> 8) & 1)
+
+/* Z64DEC_SAFE: checked before each group of literals and each match, *
+ * moving `src` to the tail once near the end of the input             */
+#define SAFE_STEP \
+	if (safe) \
+	{ \
+		unsigned char *p = safe_step(&tail, start, src + ilen, &src_lim); \
+		if (!p) \
+			return 0; \
+		if (p != src + ilen) \
+		{ \
+			src = p; \
+			ilen = 0; \
+		} \
+	}
+#define SAFE_LITERALS \
+	SAFE_STEP \
+	if (safe && n + 1 > (size_t)(dst_lim - dst)) \
+		return 0;
+
+/* flat variant of the above; src is the whole file, header included, *
+ * and `safe` is non-zero if it is `sz` bytes that can't be trusted    */
+static inline size_t decompress_flat(struct z64dec_ctx *dec, unsigned char *src, unsigned char *_dst, const int safe, size_t sz)
+{
+	unsigned char *dst = _dst;
+	unsigned char *dst_lim = _dst;
+	unsigned char *start = src;
+	unsigned char *src_lim = src + sz;
+	struct safe_tail tail;
+	unsigned int last_m_off = 1;
+	unsigned int ilen = 8; /* skip the 8-byte header */
+	unsigned int bb = 0;
+	
+	tail.from = NULL;
+	if (safe)
+		dst_lim += safe_room(dec, src, sz);
+	
+	for (;;)
+	{
+		unsigned int m_off;
+		unsigned int m_len;
+		
+		SAFE_STEP
+		copy_literals(src, getbit_flat, SAFE_LITERALS)
+		
+		SAFE_STEP
+		m_off = 1;
+		getgamma(m_off, getbit_flat, safe ? SAFE_GAMMA_MAX : ~0u)
+		if (safe && m_off > SAFE_GAMMA_MAX)
+			return 0;
+		if (m_off == 2)
+			m_off = last_m_off;
+		else
+		{
+			m_off = (m_off-3)*256 + src[ilen++];
+			if (m_off == 0xffffffff)
+				break;
+			last_m_off = ++m_off;
+		}
+		
+		m_len = getbit_flat(bb);
+		m_len = m_len*2 + getbit_flat(bb);
+		if (m_len == 0)
+		{
+			m_len = 1;
+			getgamma(m_len, getbit_flat, safe ? SAFE_GAMMA_MAX : ~0u)
+			m_len += 2;
+		}
+		m_len += (m_off > 0xd00);
+		{
+			const unsigned char *m_pos = dst - m_off;
+			
+			m_len += 1;
+			if (safe && (m_off > (size_t)(dst - _dst) || m_len > (size_t)(dst_lim - dst)))
+				return 0;
+			dst = match_copy(dst, m_pos, m_len);
+		}
+	}
+	
+	/* the end marker may have gone on past the end */
+	if (safe && src + ilen > src_lim)
+		return 0;
+	
+	dec->src_end = safe ? safe_input(&tail, src + ilen) : src + ilen;
+	
+	/* get the final decompressed size */
+	return dst - _dst;
+}
+
+/* main driver */
+size_t ucldec_ctx(struct z64dec_ctx *dec, void *src, void *dst, size_t sz)
+{
+	/* read directly from the file, it is already in memory */
+	if (dec->flags & Z64DEC_FLAT)
+	{
+		/* too small to hold a header and an end marker */
+		if (sz < 8 + 4)
+			return 0;
+		
+		if (dec->flags & Z64DEC_SAFE)
+			return decompress_flat(dec, src, dst, 1, sz);
+		return decompress_flat(dec, src, dst, 0, sz);
+	}
+	
+	return decompress_dma(dec, src, dst, sz);
+}
+
+/* main driver, using a shared context */
+size_t ucldec(void *src, void *dst, size_t sz)
+{
+	static struct z64dec_ctx ctx;
+	
+	return ucldec_ctx(&ctx, src, dst, sz);
+}
@@ -1,103 +1,140 @@
 /* <z64.me> yaz decompression using intermediate buffer */
 
+#include <stdlib.h> /* malloc, free */
+
+#include "decoder.h"
 #include "private.h"
 
-struct decoder
-{
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
-	unsigned char  *buf_end;     /* pointer that exists for the sole *
-	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
-	unsigned int    remaining;   /* remaining size of file           */
-	unsigned char  *buf_limit;   /* points to end of scannable area  *
-	                              * of buf; this prevents yaz parser *
-	                              * from overflowing                 */
-#if MAJORA
-	unsigned char  *dst_end;     /* end of decompressed block        */
-#endif
+/* number of literals at the top of a code byte, before its first *
+ * match, so a run of them is copied at once rather than a bit at  *
+ * a time; bits already used are shifted out as zeroes, so a run   *
+ * never goes past the last valid bit                              */
+static const unsigned char literalRun[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 7, 8,
 };
 
-static struct decoder dec;
+/* copy fewer than 8 literals, without calling out to memcpy */
+static inline void lit_copy_short(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	if (n & 4)
+	{
+		memcpy(dst, src, 4);
+		dst += 4;
+		src += 4;
+	}
+	if (n & 2)
+	{
+		memcpy(dst, src, 2);
+		dst += 2;
+		src += 2;
+	}
+	if (n & 1)
+		*dst = *src;
+}
 
 /* initialize yaz */
-static inline unsigned char *init(void)
+static inline unsigned char *init(struct z64dec_ctx *dec)
 {
 	unsigned int size;
 	
-	dec.buf_limit = dec.buf_end - 25;
+	dec->buf_limit = dec->buf_end - 25;
 	
 	/* default size = decompression buffer size */
-	size = dec.buf_end - dec.buf;
+	size = dec->buf_end - dec->buf;
 	
 	/* if remaining file size is less than default, use that */
-	if (dec.remaining < size)
-		size = dec.remaining;
+	if (dec->remaining < size)
+		size = dec->remaining;
 	
-	DMARomToRam(dec.pstart, dec.buf, size);
+	DMARomToRam(dec->pstart, dec->buf, size);
 	
 	/* advance pstart */
-	dec.pstart += size;
+	dec->pstart += size;
 	
 	/* decrease remaining sz */
-	dec.remaining -= size;
+	dec->remaining -= size;
 	
-	return dec.buf;
+	return dec->buf;
 }
 
 /* request more yaz data */
-static inline unsigned char *refill(unsigned char *src)
+static inline unsigned char *refill(struct z64dec_ctx *dec, unsigned char *src)
 {
 	unsigned int    size;
 	unsigned int    length;
 	unsigned char  *dst;
 	
 	/* length = bytes remaining in buffer */
-	length = dec.buf_end - src;
+	length = dec->buf_end - src;
 	
 	/* bcopy src and dst must be aligned */
 	if ((length & 7) == 0)
-		dst = dec.buf;
+		dst = dec->buf;
 	else
-		dst = (dec.buf + 8) - (length & 7);
+		dst = (dec->buf + 8) - (length & 7);
 	
 	/* copy remainder of current buffer back to beginning */
 	Bcopy(src, dst, length);
 	
 	/* calculate size for next read */
-	size = (dec.buf_end - dst) - length;
+	size = (dec->buf_end - dst) - length;
 	
 	/* if it exceeds remaining file size, use that */
-	if (dec.remaining < size)
-		size = dec.remaining;
+	if (dec->remaining < size)
+		size = dec->remaining;
 	
 	/* read file from rom */
 	if (size != 0)
 	{
-		DMARomToRam(dec.pstart, dst + length, size);
+		DMARomToRam(dec->pstart, dst + length, size);
 		
-		dec.pstart += size;
-		dec.remaining -= size;
+		dec->pstart += size;
+		dec->remaining -= size;
 		
-		if (dec.remaining == 0)
-			dec.buf_limit = dst + length + size;
+		if (dec->remaining == 0)
+			dec->buf_limit = dst + length + size;
 	}
 	
 	return dst;
 }
 
-/* decompress yaz data */
+/* decompress yaz data; `flat` is non-zero if src is the whole file, *
+ * and `safe` if it is also `sz` bytes that can't be trusted          */
 /* yaz0dec by thakis was referenced for this */
-static inline size_t decompress(unsigned char *src, unsigned char *_dst)
+static inline size_t decompress(struct z64dec_ctx *dec, unsigned char *src, unsigned char *_dst, const int flat, const int safe, size_t sz)
 {
 	unsigned char *dst = _dst;
+	unsigned char *start = src;
+	unsigned char *src_lim = src + (safe ? sz : 0);
+	struct safe_tail tail;
 	unsigned int currCodeByte;
-	unsigned int nmult;
 	int validBitCount = 0;
+	int near = 0; /* safe: matches can go out of bounds */
 	int uncomp_sz;
 	
 	/* get decompressed size from header */
 	uncomp_sz = BE32(src + 4);
 	
+	/* the output has to fit, and not be empty */
+	tail.from = NULL;
+	if (safe && (uncomp_sz <= 0 || (size_t)uncomp_sz > safe_room(dec, src, sz)))
+		return 0;
+	
 	/* skip header */
 	src += 16;
 	
@@ -107,16 +144,46 @@ static inline size_t decompress(unsigned char *src, unsigned char *_dst)
 		if (validBitCount == 0)
 		{
 			/* refill intermediate buffer if needed */
-			if (dec.buf_limit < src && dec.remaining != 0)
-				src = refill(src);
+			if (!flat && dec->buf_limit < src && dec->remaining != 0)
+				src = refill(dec, src);
+			
+			/* a code byte and what follows it is at most 25 bytes, *
+			 * which output at most 8 * 0x111; only near the start  *
+			 * or end of the output is each match checked           */
+			if (safe)
+			{
+				if (!(src = safe_step(&tail, start, src, &src_lim)))
+					return 0;
+				near = dst - _dst <= 0x1000 || _dst + uncomp_sz - dst < 8 * 0x111;
+			}
 			
 			currCodeByte = *src;
 			validBitCount = 8;
 			src++;
 		}
 		
-		/* is not uncompressed */
-		if (!(currCodeByte & 0x80))
+		/* straight copy of every literal up to the next match; 0xFF, *
+		 * eight in a row, is common in data that barely compresses    */
+		if (currCodeByte & 0x80)
+		{
+			size_t run = literalRun[currCodeByte & 0xFF];
+			
+			if (run > (size_t)(_dst + uncomp_sz - dst))
+				run = _dst + uncomp_sz - dst;
+			
+			/* a whole code byte of them is a single move */
+			if (run == 8)
+				copy8(dst, src);
+			else
+				lit_copy_short(dst, src, run);
+			dst += run;
+			src += run;
+			validBitCount -= run;
+			currCodeByte <<= run;
+			continue;
+		}
+		
+		/* otherwise, a back-reference */
 		{
 			unsigned char   byte1 = src[0];
 			unsigned char   byte2 = src[1];
@@ -136,70 +203,244 @@ static inline size_t decompress(unsigned char *src, unsigned char *_dst)
 			else
 				numBytes += 2;
 			
-		/* NOTE: this is unrolled to maximize performance */
+			if (safe && near && (dist >= (size_t)(dst - _dst) || numBytes > (size_t)(_dst + uncomp_sz - dst)))
+				return 0;
 			
-			/* get remaining bytes to a multiple of 4 */
-			nmult = numBytes - (numBytes & 3);
-			if (numBytes & 3)
+			dst = match_copy_fast(dst, copySrc, numBytes, _dst + uncomp_sz - dst);
+		}
+		
+		validBitCount -= 1;
+		currCodeByte <<= 1;
+	} while (dst != _dst + uncomp_sz);
+	
+	/* the last code byte may have gone on past the end */
+	if (safe && src > src_lim)
+		return 0;
+	
+	if (flat)
+		dec->src_end = safe ? safe_input(&tail, src) : src;
+	
+#if MAJORA
+	dec->dst_end = dst;
+#endif
+
+	return uncomp_sz;
+}
+
+/* output kept by decompress_stream between chunks */
+#define STREAM_WINDOW 0x1000          /* farthest a match reaches back  */
+#define STREAM_CHUNK  0x10000         /* output handed off at a time    */
+#define STREAM_SLACK  (8 * 0x111 + 16) /* most one code byte can output, *
+                                       * plus match_copy_fast overshoot */
+
+/* decompress yaz data to `write`, a chunk at a time; the same as *
+ * decompress(), except only the window that matches can refer   *
+ * back to is kept around once a chunk has been handed off; it is *
+ * too big for the stack of a worker thread, so it's on the heap  */
+static inline size_t decompress_stream(struct z64dec_ctx *dec, unsigned char *src, const int flat, const int safe, size_t sz, z64dec_write_fn write, void *udata)
+{
+	enum { BUF_SZ = STREAM_WINDOW + STREAM_CHUNK + STREAM_SLACK };
+	unsigned char *buf;
+	unsigned char *dst;
+	unsigned char *pending;       /* output not yet handed off */
+	unsigned char *end;
+	unsigned char *start = src;
+	unsigned char *src_lim = src + (safe ? sz : 0);
+	struct safe_tail tail;
+	size_t dropped = 0;           /* output shifted out of buf */
+	size_t written = 0;
+	unsigned int currCodeByte;
+	int validBitCount = 0;
+	int near = 0; /* safe: matches can go out of bounds */
+	size_t uncomp_sz;
+	
+	/* get decompressed size from header */
+	uncomp_sz = BE32(src + 4);
+	
+	/* the output has to fit, and not be empty */
+	tail.from = NULL;
+	if (safe && (uncomp_sz == 0 || uncomp_sz > safe_room(dec, src, sz)))
+		return 0;
+	
+	if (!(buf = malloc(BUF_SZ)))
+		return 0;
+	dst = pending = buf;
+	
+	/* skip header */
+	src += 16;
+	
+	while (dropped + (dst - buf) < uncomp_sz)
+	{
+		if (validBitCount == 0)
+		{
+			/* hand off a full chunk, keeping the window behind it */
+			if (dst >= buf + STREAM_WINDOW + STREAM_CHUNK)
 			{
-				do
-				{
-					*dst = *copySrc;
-					dst++;
-					copySrc++;
-					numBytes -= 1;
-				} while (numBytes != nmult);
+				if (write(udata, pending, dst - pending))
+					goto stop;
 				
-				if (numBytes == 0)
-					goto L_skip;
+				memmove(buf, dst - STREAM_WINDOW, STREAM_WINDOW);
+				dropped += (dst - buf) - STREAM_WINDOW;
+				dst = pending = buf + STREAM_WINDOW;
 			}
 			
-			/* transfer remaining block four bytes at a time */
-			do
+			/* refill intermediate buffer if needed */
+			if (!flat && dec->buf_limit < src && dec->remaining != 0)
+				src = refill(dec, src);
+			
+			/* as in decompress(); once a chunk has been handed off, *
+			 * the window behind dst covers any distance             */
+			if (safe)
 			{
-				dst[0] = copySrc[0];
-				dst[1] = copySrc[1];
-				dst[2] = copySrc[2];
-				dst[3] = copySrc[3];
-				numBytes -= 4;
-				copySrc += 4;
-				dst += 4;
-			} while (numBytes != 0);
+				if (!(src = safe_step(&tail, start, src, &src_lim)))
+					goto fail;
+				near = (!dropped && dst - buf <= 0x1000)
+					|| uncomp_sz - dropped - (dst - buf) < 8 * 0x111;
+			}
+			
+			currCodeByte = *src;
+			validBitCount = 8;
+			src++;
 		}
 		
-		/* straight copy */
-		else
-			*dst++ = *src++;
+		/* straight copy of every literal up to the next match; 0xFF, *
+		 * eight in a row, is common in data that barely compresses    */
+		if (currCodeByte & 0x80)
+		{
+			size_t run = literalRun[currCodeByte & 0xFF];
+			
+			if (run > uncomp_sz - dropped - (dst - buf))
+				run = uncomp_sz - dropped - (dst - buf);
+			
+			/* a whole code byte of them is a single move */
+			if (run == 8)
+				copy8(dst, src);
+			else
+				lit_copy_short(dst, src, run);
+			dst += run;
+			src += run;
+			validBitCount -= run;
+			currCodeByte <<= run;
+			continue;
+		}
+		
+		/* otherwise, a back-reference */
+		{
+			unsigned char   byte1 = src[0];
+			unsigned char   byte2 = src[1];
+			
+			unsigned int    dist = ((byte1 & 0xF) << 8) | byte2;
+			unsigned char  *copySrc = dst - (dist + 1);
+			
+			unsigned int    numBytes = byte1 >> 4;
+			
+			src += 2;
+			
+			if (numBytes == 0)
+			{
+				numBytes = *src + 0x12;
+				src++;
+			}
+			else
+				numBytes += 2;
+			
+			if (safe && near && (dist >= dropped + (dst - buf) || numBytes > uncomp_sz - dropped - (dst - buf)))
+				goto fail;
+			
+			dst = match_copy_fast(dst, copySrc, numBytes, buf + BUF_SZ - dst);
+		}
 		
-L_skip:
 		validBitCount -= 1;
 		currCodeByte <<= 1;
-	} while (dst != _dst + uncomp_sz);
+	}
+	
+	/* the last code byte may have gone on past the end */
+	if (safe && src > src_lim)
+		goto fail;
+	
+	/* the last match can run past the end of the file */
+	end = buf + (uncomp_sz - dropped);
+	if (end > pending && write(udata, pending, end - pending))
+		goto stop;
+	
+	free(buf);
+	return uncomp_sz;
+
+stop:
+	written = dropped + (pending - buf);
+fail:
+	free(buf);
+	return written;
+}
+
+/* main driver */
+size_t yazdec_ctx(struct z64dec_ctx *dec, void *src, void *dst, size_t sz)
+{
+	size_t uncomp_sz;
+
+	/* read directly from the file, it is already in memory */
+	if (dec->flags & Z64DEC_FLAT)
+	{
+		/* too small to hold a header */
+		if (sz < 16)
+			return 0;
+		
+		if (dec->flags & Z64DEC_SAFE)
+			return decompress(dec, src, dst, 1, 1, sz);
+		return decompress(dec, src, dst, 1, 0, sz);
+	}
+	
+	/* initialize decoder structure */
+	dec->buf_end = dec->buf + sizeof(dec->buf);
+	dec->pstart = src;
+	dec->remaining = sz;
+	
+	/* decompress file */
+	uncomp_sz = decompress(dec, init(dec), dst, 0, 0, sz);
 	
 #if MAJORA
-	dec.dst_end = dst;
+	dec->buf_end = 0;
 #endif
 
 	return uncomp_sz;
 }
 
-/* main driver */
-size_t yazdec(void *src, void *dst, size_t sz)
+/* streaming driver */
+size_t yazdec_stream(struct z64dec_ctx *dec, void *src, size_t sz, z64dec_write_fn write, void *udata)
 {
 	size_t uncomp_sz;
 
+	/* read directly from the file, it is already in memory */
+	if (dec->flags & Z64DEC_FLAT)
+	{
+		/* too small to hold a header */
+		if (sz < 16)
+			return 0;
+		
+		if (dec->flags & Z64DEC_SAFE)
+			return decompress_stream(dec, src, 1, 1, sz, write, udata);
+		return decompress_stream(dec, src, 1, 0, sz, write, udata);
+	}
+	
 	/* initialize decoder structure */
-	dec.buf_end = dec.buf + sizeof(dec.buf);
-	dec.pstart = src;
-	dec.remaining = sz;
+	dec->buf_end = dec->buf + sizeof(dec->buf);
+	dec->pstart = src;
+	dec->remaining = sz;
 	
 	/* decompress file */
-	uncomp_sz = decompress(init(), dst);
+	uncomp_sz = decompress_stream(dec, init(dec), 0, 0, sz, write, udata);
 	
 #if MAJORA
-	dec.buf_end = 0;
+	dec->buf_end = 0;
 #endif
 
 	return uncomp_sz;
 }
 
+/* main driver, using a shared context */
+size_t yazdec(void *src, void *dst, size_t sz)
+{
+	static struct z64dec_ctx ctx;
+	
+	return yazdec_ctx(&ctx, src, dst, sz);
+}
@@ -1,5 +1,8 @@
 /* <z64.me> oot style zlib decompression using intermediate buffer */
 
+#include <stdlib.h> /* malloc, free */
+
+#include "decoder.h"
 #include "private.h"
 
 /*
@@ -1189,60 +1192,473 @@ static int gen_huffman_table(unsigned int symbols,
 
 /* End of tinflate.c */
 
-struct decoder
+/* fast inflate, for when the whole stream is in memory
+ *
+ * this decodes Huffman codes through two-level lookup tables and
+ * keeps a 64-bit bit buffer topped up a word at a time, rather than
+ * walking a tree one bit at a time; it doesn't handle anything out of
+ * the ordinary (incomplete code tables, reading past the end of the
+ * input, output past `out_max`) and leaves that to tinflate instead,
+ * which is rerun from the start whenever this returns FAST_FAIL
+ */
+
+#define FAST_FAIL  ((unsigned long)-1)
+
+/* bits indexing the root tables; longer codes use a subtable */
+#define LIT_ROOT   10
+#define DIST_ROOT  8
+
+/* a table entry is (sym << 16) | (sub << 8) | len: consume `len` bits,
+ * then if `sub` is zero, `sym` is the symbol, otherwise the next `sub`
+ * bits index the subtable starting at `sym`; an all-zero entry is
+ * invalid (codes are never zero bits long)
+ */
+#define ENTRY(SYM, SUB, LEN) (((SYM) << 16) | ((SUB) << 8) | (LEN))
+#define ENTRY_SYM(E)         ((E) >> 16)
+#define ENTRY_SUB(E)         (((E) >> 8) & 0xff)
+#define ENTRY_LEN(E)         ((E) & 0xff)
+
+/* room for the root table plus a subtable for every symbol, which is
+ * more than a valid code can ever need
+ */
+#define LIT_ENTRIES   ((1 << LIT_ROOT) + 288 * (1 << (15 - LIT_ROOT)))
+#define DIST_ENTRIES  ((1 << DIST_ROOT) + 32 * (1 << (15 - DIST_ROOT)))
+
+struct fast_inflate
 {
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
-	unsigned char  *buf_end;     /* pointer that exists for the sole *
-	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
-	unsigned int    remaining;   /* remaining size of file           */
-	unsigned char  *buf_limit;   /* points to end of scannable area  *
-	                              * of buf; this prevents yaz parser *
-	                              * from overflowing                 */
-#if MAJORA
-	unsigned char  *dst_end;     /* end of decompressed block        */
-#endif
+	unsigned int lit[LIT_ENTRIES];
+	unsigned int dist[DIST_ENTRIES];
+	unsigned int codelen[1 << 7];
 };
 
-static struct decoder dec;
+/* base values and extra bits for length and distance symbols */
+static const unsigned short length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const unsigned char dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* build a lookup table from a set of code lengths; returns 0 if the
+ * code is not complete, except that a code with no symbols at all is
+ * allowed, and produces a table of invalid entries
+ */
+static int fast_table(unsigned int *table, unsigned int root, const unsigned char *lengths, unsigned int symbols)
+{
+	unsigned int count[16] = {0};
+	unsigned int next_code[16];
+	unsigned int next_sub = 1 << root;
+	unsigned int max = 0;
+	unsigned int sub;
+	int left = 1;
+	unsigned int i;
+	
+	for (i = 0; i < symbols; ++i)
+		count[lengths[i]] += 1;
+	count[0] = 0;
+	
+	for (i = 1; i < 16; ++i)
+	{
+		left = left * 2 - count[i];
+		if (left < 0)
+			return 0;
+		if (count[i])
+			max = i;
+	}
+	
+	/* no symbols */
+	if (max == 0)
+	{
+		memset(table, 0, sizeof(*table) << root);
+		return 1;
+	}
+	
+	if (left)
+		return 0;
+	
+	/* subtables are all the same size, enough for the longest code */
+	sub = max > root ? max - root : 0;
+	if (sub)
+		memset(table, 0, sizeof(*table) << root);
+	
+	next_code[1] = 0;
+	for (i = 1; i < 15; ++i)
+		next_code[i + 1] = (next_code[i] + count[i]) << 1;
+	
+	for (i = 0; i < symbols; ++i)
+	{
+		unsigned int len = lengths[i];
+		unsigned int code;
+		unsigned int rev = 0;
+		unsigned int k;
+		
+		if (!len)
+			continue;
+		
+		/* codes are stored starting from their most significant bit */
+		code = next_code[len]++;
+		for (k = 0; k < len; ++k)
+			rev |= ((code >> k) & 1) << (len - 1 - k);
+		
+		if (len <= root)
+		{
+			for (k = rev; k < (1U << root); k += 1 << len)
+				table[k] = ENTRY(i, 0, len);
+		}
+		else
+		{
+			unsigned int *entry = table + (rev & ((1 << root) - 1));
+			unsigned int *subtable;
+			
+			/* first code with this prefix: link a new subtable */
+			if (ENTRY_SUB(*entry) == 0)
+			{
+				*entry = ENTRY(next_sub, sub, root);
+				next_sub += 1 << sub;
+			}
+			subtable = table + ENTRY_SYM(*entry);
+			
+			len -= root;
+			for (k = rev >> root; k < (1U << sub); k += 1 << len)
+				subtable[k] = ENTRY(i, 0, len);
+		}
+	}
+	
+	return 1;
+}
+
+/* read 8 bytes as a little-endian word */
+static inline unsigned long long le64(const unsigned char *src)
+{
+	return (unsigned long long)src[0]
+		| (unsigned long long)src[1] << 8
+		| (unsigned long long)src[2] << 16
+		| (unsigned long long)src[3] << 24
+		| (unsigned long long)src[4] << 32
+		| (unsigned long long)src[5] << 40
+		| (unsigned long long)src[6] << 48
+		| (unsigned long long)src[7] << 56;
+}
+
+/* ensure the bit buffer holds at least 56 bits; near the end of the
+ * input, it is padded with zeroes, and reading too far into those
+ * gives up on the stream
+ */
+#define FILL() \
+	if (bitcnt <= 56) \
+	{ \
+		if (in_end - in >= 8) \
+		{ \
+			bitbuf |= le64(in) << bitcnt; \
+			in += (63 - bitcnt) >> 3; \
+			bitcnt |= 56; \
+		} \
+		else \
+		{ \
+			if (in - in_end > 8) \
+				return FAST_FAIL; \
+			do \
+			{ \
+				if (in < in_end) \
+					bitbuf |= (unsigned long long)*in << bitcnt; \
+				in += 1; \
+				bitcnt += 8; \
+			} while (bitcnt <= 56); \
+		} \
+	}
+
+/* take `N` bits from the bit buffer */
+#define BITS(N)     (unsigned int)(bitbuf & ((1ULL << (N)) - 1))
+#define DROP(N)     do { bitbuf >>= (N); bitcnt -= (N); } while (0)
+
+/* decode a symbol from `TABLE` into `SYM`; the bit buffer must hold *
+ * at least 15 bits, and an invalid code gives up on the stream      */
+#define DECODE(SYM, TABLE, ROOT) \
+	do { \
+		unsigned int e = (TABLE)[BITS(ROOT)]; \
+		if (ENTRY_SUB(e)) \
+		{ \
+			DROP(ROOT); \
+			e = (TABLE)[ENTRY_SYM(e) + BITS(ENTRY_SUB(e))]; \
+		} \
+		if (!e) \
+			return FAST_FAIL; \
+		DROP(ENTRY_LEN(e)); \
+		SYM = ENTRY_SYM(e); \
+	} while (0)
+
+/* inflate `src` into `dst`; returns the decompressed size, with *
+ * the end of the stream in *src_end, or FAST_FAIL if the stream *
+ * needs to be left to tinflate                                  */
+static unsigned long fast_inflate(struct fast_inflate *tab, const unsigned char *src, unsigned long sz, unsigned char *dst, unsigned long out_max, const unsigned char **src_end)
+{
+	const unsigned char *in = src;
+	const unsigned char *in_end = src + sz;
+	unsigned char *out = dst;
+	unsigned char *out_end = dst + out_max;
+	unsigned long long bitbuf = 0;
+	unsigned int bitcnt = 0;
+	unsigned int final;
+	
+	/* skip the zlib header, if present (as tinflate detects it) */
+	if (sz < 2)
+		return FAST_FAIL;
+	{
+		unsigned int zlib_header = src[0] << 8 | src[1];
+		
+		if ((zlib_header & 0x8F00) == 0x0800 && zlib_header % 31 == 0)
+		{
+			/* custom dictionaries are not supported */
+			if (zlib_header & 0x0020)
+				return FAST_FAIL;
+			in += 2;
+		}
+	}
+	
+	do
+	{
+		unsigned int type;
+		
+		FILL()
+		final = BITS(1);
+		type = (bitbuf >> 1) & 3;
+		DROP(3);
+		
+		/* uncompressed block */
+		if (type == 0)
+		{
+			unsigned int len;
+			unsigned int skip = bitcnt & 7;
+			
+			/* tinflate doesn't discard the bits that pad out the byte */
+			if (BITS(skip))
+				return FAST_FAIL;
+			DROP(skip);
+			FILL()
+			len = BITS(16);
+			if (((bitbuf >> 16) & 0xffff) != (~len & 0xffff))
+				return FAST_FAIL;
+			DROP(32);
+			
+			/* return the unused bytes to the input */
+			in -= bitcnt >> 3;
+			bitbuf = 0;
+			bitcnt = 0;
+			if (in > in_end || (unsigned long)(in_end - in) < len
+				|| (unsigned long)(out_end - out) < len
+			)
+				return FAST_FAIL;
+			memcpy(out, in, len);
+			out += len;
+			in += len;
+			continue;
+		}
+		
+		/* fixed codes */
+		else if (type == 1)
+		{
+			unsigned char lengths[288 + 32];
+			
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 256 - 144);
+			memset(lengths + 256, 7, 280 - 256);
+			memset(lengths + 280, 8, 288 - 280);
+			memset(lengths + 288, 5, 32);
+			fast_table(tab->lit, LIT_ROOT, lengths, 288);
+			fast_table(tab->dist, DIST_ROOT, lengths + 288, 32);
+		}
+		
+		/* dynamic codes */
+		else if (type == 2)
+		{
+			static const unsigned char codelen_order[19] = {
+				16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+			};
+			unsigned char lengths[288 + 32];
+			unsigned char codelen_len[19] = {0};
+			unsigned int literal_count;
+			unsigned int distance_count;
+			unsigned int codelen_count;
+			unsigned int i;
+			
+			FILL()
+			literal_count = BITS(5) + 257;
+			distance_count = ((bitbuf >> 5) & 31) + 1;
+			codelen_count = ((bitbuf >> 10) & 15) + 4;
+			DROP(14);
+			
+			/* 19 * 3 bits won't fit in a single fill */
+			for (i = 0; i < codelen_count; ++i)
+			{
+				FILL()
+				codelen_len[codelen_order[i]] = BITS(3);
+				DROP(3);
+			}
+			if (!fast_table(tab->codelen, 7, codelen_len, 19))
+				return FAST_FAIL;
+			
+			for (i = 0; i < literal_count + distance_count; )
+			{
+				unsigned int sym;
+				unsigned int value = 0;
+				unsigned int repeat;
+				
+				FILL()
+				DECODE(sym, tab->codelen, 7);
+				if (sym < 16)
+				{
+					lengths[i++] = sym;
+					continue;
+				}
+				else if (sym == 16)
+				{
+					/* tinflate repeats a zero before the first length */
+					if (i)
+						value = lengths[i - 1];
+					repeat = BITS(2) + 3;
+					DROP(2);
+				}
+				else if (sym == 17)
+				{
+					repeat = BITS(3) + 3;
+					DROP(3);
+				}
+				else
+				{
+					repeat = BITS(7) + 11;
+					DROP(7);
+				}
+				/* tinflate stops at the end of the lengths */
+				if (repeat > literal_count + distance_count - i)
+					repeat = literal_count + distance_count - i;
+				memset(lengths + i, value, repeat);
+				i += repeat;
+			}
+			
+			if (!fast_table(tab->lit, LIT_ROOT, lengths, literal_count)
+				|| !fast_table(tab->dist, DIST_ROOT, lengths + literal_count, distance_count)
+			)
+				return FAST_FAIL;
+		}
+		
+		/* invalid block type */
+		else
+			return FAST_FAIL;
+		
+		/* decode the block */
+		for (;;)
+		{
+			unsigned int sym;
+			unsigned int len;
+			unsigned int dist;
+			
+			/* a literal/length code, length bits, a distance code, *
+			 * and distance bits need at most 48 bits all together */
+			FILL()
+			DECODE(sym, tab->lit, LIT_ROOT);
+			
+			if (sym < 256)
+			{
+				if (out == out_end)
+					return FAST_FAIL;
+				*out++ = sym;
+				continue;
+			}
+			
+			/* end of block */
+			if (sym == 256)
+				break;
+			
+			sym -= 257;
+			if (sym >= 29)
+				return FAST_FAIL;
+			len = length_base[sym] + BITS(length_extra[sym]);
+			DROP(length_extra[sym]);
+			
+			DECODE(sym, tab->dist, DIST_ROOT);
+			if (sym >= 30)
+				return FAST_FAIL;
+			dist = dist_base[sym] + BITS(dist_extra[sym]);
+			DROP(dist_extra[sym]);
+			
+			if (dist > (unsigned long)(out - dst)
+				|| len > (unsigned long)(out_end - out)
+			)
+				return FAST_FAIL;
+			
+			out = match_copy(out, out - dist, len);
+		}
+	} while (!final);
+	
+	/* the stream must not have run past the end of the input */
+	if (in - (bitcnt >> 3) > in_end)
+		return FAST_FAIL;
+	
+	*src_end = in - (bitcnt >> 3);
+	return out - dst;
+}
+
+#undef FILL
+#undef BITS
+#undef DROP
+#undef DECODE
+
 
 /* request more compressed data */
-static inline unsigned refill(void)
+static inline unsigned refill(struct z64dec_ctx *dec)
 {
 	unsigned int    size;
-	unsigned char  *dst = dec.buf;
+	unsigned char  *dst = dec->buf;
 	
 	/* calculate size for next read */
-	size = sizeof(dec.buf);
+	size = sizeof(dec->buf);
 	
 	/* if it exceeds remaining file size, use that */
-	if (dec.remaining < size)
-		size = dec.remaining;
+	if (dec->remaining < size)
+		size = dec->remaining;
 	
 	/* read file from rom */
-	DMARomToRam(dec.pstart, dst, size);
+	DMARomToRam(dec->pstart, dst, size);
 	
-	dec.pstart += size;
-	dec.remaining -= size;
+	dec->pstart += size;
+	dec->remaining -= size;
 	
 	return size;
 }
 
+/* room assumed at dst if the caller doesn't know it: 32mb */
+#define DST_MAX (1024 * 1024 * 32)
+
 /* main driver */
-size_t zlibdec(void *src_, void *dst_, size_t sz)
+size_t zlibdec_ctx(struct z64dec_ctx *dec, void *src_, void *dst_, size_t sz)
 {
 	unsigned char *dst = dst_;
 	unsigned char *src = src_;
 	DecompressionState state;
 	
+	/* too small to hold a header */
+	if (sz < 8)
+		return 0;
+	
 	/* skip header */
 	src += 8;
 	sz -= 8;
 	
 	/* initialize decoder structure */
-	dec.buf_end = dec.buf + sizeof(dec.buf);
-	dec.pstart = src;
-	dec.remaining = sz;
+	dec->buf_end = dec->buf + sizeof(dec->buf);
+	dec->pstart = src;
+	dec->remaining = sz;
 
 	/* clear decompression state buffer */
 	state.state	    = INITIAL;
@@ -1255,16 +1671,63 @@ size_t zlibdec(void *src_, void *dst_, size_t sz)
 	state.final	    = 0;
 	/* no other fields need to be cleared */
 	
+	/* the file is already in memory, so inflate it in one pass; *
+	 * inflating never reads past `sz`, and with Z64DEC_SAFE, it *
+	 * never writes past what the header says either; the fast   *
+	 * path's tables are too big for the stack of a worker       *
+	 * thread, so they're on the heap, and without them the file *
+	 * is left to tinflate                                       */
+	if (dec->flags & Z64DEC_FLAT)
+	{
+		unsigned long dstMax = dec->dst_max ? dec->dst_max : DST_MAX;
+		unsigned long size = 0;
+		unsigned long crc_ret;
+		const unsigned char *end;
+		struct fast_inflate *tab;
+		
+		if ((dec->flags & Z64DEC_SAFE) && !dec->dst_max)
+			dstMax = z64dec_header_size(src_, sz + 8);
+		
+		if ((tab = malloc(sizeof(*tab))))
+		{
+			size = fast_inflate(tab, src, sz, dst, dstMax, &end);
+			free(tab);
+			if (size != FAST_FAIL)
+			{
+				dec->src_end = (unsigned char *)end;
+				return size;
+			}
+		}
+		
+		/* let tinflate deal with anything unusual */
+		size = 0;
+		if (tinflate_partial(
+			src, sz,
+			dst, dstMax,
+			&size, &crc_ret,
+			&state, sizeof(state)
+		))
+			return 0;
+		
+		/* tinflate counts what didn't fit, but doesn't write it */
+		if ((dec->flags & Z64DEC_SAFE) && size > dstMax)
+			return 0;
+		
+		/* bytes left in the accumulator were read, but not used */
+		dec->src_end = (unsigned char *)state.in_ptr - (state.num_bits >> 3);
+		return size;
+	}
+	
 	while (1)
 	{
-		int dstMax = 1024 * 1024 * 32; /* max size of any file: 32mb */
+		unsigned long dstMax = dec->dst_max ? dec->dst_max : DST_MAX;
 		unsigned long size = 0; /* XXX must be zero-initialized */
 		unsigned long crc_ret;
 		unsigned readSize;
 		int result;
-		readSize = refill();
+		readSize = refill(dec);
 		result = tinflate_partial(
-			dec.buf, readSize,
+			dec->buf, readSize,
 			dst, dstMax,
 			&size, &crc_ret,
 			&state, sizeof(state)
@@ -1275,9 +1738,15 @@ size_t zlibdec(void *src_, void *dst_, size_t sz)
 	}
 	
 #if MAJORA
-	dec.buf_end = 0;
+	dec->buf_end = 0;
 #endif
 	return dst - (unsigned char *)dst_;
 }
 
-
+/* main driver, using a shared context */
+size_t zlibdec(void *src, void *dst, size_t sz)
+{
+	static struct z64dec_ctx ctx;
+	
+	return zlibdec_ctx(&ctx, src, dst, sz);
+}
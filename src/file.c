@@ -75,6 +75,130 @@ void *file_load(const char *fn, size_t *sz)
 	return file_load_into(fn, sz, dst);
 }
 
+/* the loader's thread reads this many bytes between updates */
+#define FILE_LOADER_CHUNK (1024 * 1024)
+
+struct file_loader
+{
+	wow_thread thread;
+	wow_mutex lock;
+	wow_cond cond;           /* broadcast whenever `loaded` grows */
+	FILE *fp;
+	unsigned char *dst;
+	size_t sz;
+	size_t loaded;           /* bytes read so far */
+	int failed;
+	char *name;
+};
+
+/* read the file a chunk at a time, letting waiters know after each */
+static void file_loader_thread(void *udata)
+{
+	struct file_loader *l = udata;
+	size_t done = 0;
+	int failed = 0;
+	
+	while (done < l->sz)
+	{
+		size_t n = l->sz - done;
+		
+		if (n > FILE_LOADER_CHUNK)
+			n = FILE_LOADER_CHUNK;
+		if (fread(l->dst + done, 1, n, l->fp) != n)
+		{
+			failed = 1;
+			break;
+		}
+		done += n;
+		
+		wow_mutex_lock(&l->lock);
+		__atomic_store_n(&l->loaded, done, __ATOMIC_RELEASE);
+		wow_cond_broadcast(&l->cond);
+		wow_mutex_unlock(&l->lock);
+	}
+	
+	if (failed)
+	{
+		wow_mutex_lock(&l->lock);
+		l->failed = 1;
+		wow_cond_broadcast(&l->cond);
+		wow_mutex_unlock(&l->lock);
+	}
+}
+
+/* start reading a file into an existing buffer on another thread, *
+ * a chunk at a time; *sz is set to the size of the file            */
+struct file_loader *file_loader_start(const char *fn, size_t *sz, void *dst)
+{
+	struct file_loader *l;
+	
+	assert(fn);
+	assert(sz);
+	assert(dst);
+	
+	l = calloc_safe(1, sizeof(*l));
+	l->fp = fopen(fn, "rb");
+	if (!l->fp)
+		die("failed to open '%s' for reading", fn);
+	
+	fseek(l->fp, 0, SEEK_END);
+	*sz = ftell(l->fp);
+	
+	if (!*sz)
+		die("size of file '%s' is zero", fn);
+	
+	fseek(l->fp, 0, SEEK_SET);
+	
+	l->dst = dst;
+	l->sz = *sz;
+	l->name = strdup_safe(fn);
+	wow_mutex_init(&l->lock);
+	wow_cond_init(&l->cond);
+	if (wow_thread_create(&l->thread, file_loader_thread, l))
+		die("ERROR: failed to create thread");
+	
+	return l;
+}
+
+/* wait until the first `end` bytes of the file have been read */
+void file_loader_wait(struct file_loader *l, size_t end)
+{
+	int failed;
+	
+	assert(l);
+	
+	if (end > l->sz)
+		end = l->sz;
+	
+	/* most of the time it's there already */
+	if (__atomic_load_n(&l->loaded, __ATOMIC_ACQUIRE) >= end)
+		return;
+	
+	wow_mutex_lock(&l->lock);
+	while (l->loaded < end && !l->failed)
+		wow_cond_wait(&l->cond, &l->lock);
+	failed = l->loaded < end;
+	wow_mutex_unlock(&l->lock);
+	
+	if (failed)
+		die("failed to read contents of '%s'", l->name);
+}
+
+/* wait until the whole file has been read, then free the loader */
+void file_loader_finish(struct file_loader *l)
+{
+	assert(l);
+	
+	file_loader_wait(l, l->sz);
+	wow_thread_join(l->thread);
+	
+	fclose(l->fp);
+	wow_cond_destroy(&l->cond);
+	wow_mutex_destroy(&l->lock);
+	free(l->name);
+	free(l);
+}
+
 /* write file */
 unsigned file_write(const char *fn, void *data, unsigned data_sz)
 {
@@ -96,3 +220,116 @@ unsigned file_write(const char *fn, void *data, unsigned data_sz)
 	return data_sz;
 }
 
+/* map a file into memory; changes made to it are not written back */
+void *file_map(const char *fn, size_t *sz)
+{
+	void *data;
+	
+	assert(fn);
+	assert(sz);
+	
+	data = wow_map_file(fn, sz);
+	if (!data)
+		die("failed to map '%s' for reading", fn);
+	
+	return data;
+}
+
+/* create a zero-filled file and map it into memory for writing */
+void *file_map_new(const char *fn, size_t sz)
+{
+	void *data;
+	
+	assert(fn);
+	assert(sz);
+	
+	data = wow_map_new_file(fn, sz);
+	if (!data)
+		die("failed to map '%s' for writing", fn);
+	
+	return data;
+}
+
+/* unmap a file, writing back any changes if it was made by file_map_new */
+void file_unmap(void *data, size_t sz)
+{
+	assert(data);
+	
+	wow_unmap_file(data, sz);
+}
+
+/* zero runs shorter than this are written out rather than skipped */
+#define FILE_WRITER_BLOCK 4096
+
+struct file_writer
+{
+	wow_fd fd;
+	char *name;
+};
+
+/* create a file of `sz` bytes to be written piece by piece, in any *
+ * order and from any thread; the parts never written read as zero  */
+struct file_writer *file_writer_open(const char *fn, size_t sz)
+{
+	struct file_writer *w;
+	
+	assert(fn);
+	
+	w = malloc_safe(sizeof(*w));
+	if (wow_open_sparse(fn, sz, &w->fd))
+		die("failed to open '%s' for writing", fn);
+	w->name = strdup_safe(fn);
+	
+	return w;
+}
+
+/* returns non-zero if every byte of a block is zero */
+static int is_zero(const unsigned char *data, size_t sz)
+{
+	return !data[0] && !memcmp(data, data + 1, sz - 1);
+}
+
+/* write `sz` bytes at `offset`; if `sparse` is non-zero, no part of *
+ * the range has been written yet, so runs of zeroes are skipped and *
+ * left as holes in the file                                         */
+void file_writer_write(struct file_writer *w, const void *data, size_t sz, size_t offset, int sparse)
+{
+	const unsigned char *d = data;
+	const unsigned char *run = d; /* start of bytes not yet written */
+	const unsigned char *end = d + sz;
+	const unsigned char *block;
+	
+	assert(w);
+	assert(data || !sz);
+	
+	/* look for zeroes in whole blocks of the file */
+	if (sparse)
+	{
+		for (block = d + (FILE_WRITER_BLOCK - offset % FILE_WRITER_BLOCK) % FILE_WRITER_BLOCK
+			; block + FILE_WRITER_BLOCK <= end
+			; block += FILE_WRITER_BLOCK
+		)
+		{
+			if (!is_zero(block, FILE_WRITER_BLOCK))
+				continue;
+			
+			if (block > run && wow_pwrite(w->fd, run, block - run, offset + (run - d)))
+				die("failed to write contents of '%s'", w->name);
+			run = block + FILE_WRITER_BLOCK;
+		}
+	}
+	
+	if (end > run && wow_pwrite(w->fd, run, end - run, offset + (run - d)))
+		die("failed to write contents of '%s'", w->name);
+}
+
+/* finish writing a file */
+void file_writer_close(struct file_writer *w)
+{
+	assert(w);
+	
+	if (wow_close_fd(w->fd))
+		die("failed to write contents of '%s'", w->name);
+	free(w->name);
+	free(w);
+}
@@ -10,8 +10,45 @@ void *file_load_into(const char *fn, size_t *sz, void *dst);
 /* load a file */
 void *file_load(const char *fn, size_t *sz);
 
+/* a file being read into memory by a thread of its own */
+struct file_loader;
+
+/* start reading a file into an existing buffer on another thread, *
+ * a chunk at a time; *sz is set to the size of the file            */
+struct file_loader *file_loader_start(const char *fn, size_t *sz, void *dst);
+
+/* wait until the first `end` bytes of the file have been read */
+void file_loader_wait(struct file_loader *l, size_t end);
+
+/* wait until the whole file has been read, then free the loader */
+void file_loader_finish(struct file_loader *l);
+
 /* write file */
 unsigned file_write(const char *fn, void *data, unsigned data_sz);
 
+/* map a file into memory; changes made to it are not written back */
+void *file_map(const char *fn, size_t *sz);
+
+/* create a zero-filled file and map it into memory for writing */
+void *file_map_new(const char *fn, size_t sz);
+
+/* unmap a file, writing back any changes if it was made by file_map_new */
+void file_unmap(void *data, size_t sz);
+
+/* a file being written piece by piece */
+struct file_writer;
+
+/* create a file of `sz` bytes to be written piece by piece, in any *
+ * order and from any thread; the parts never written read as zero  */
+struct file_writer *file_writer_open(const char *fn, size_t sz);
+
+/* write `sz` bytes at `offset`; if `sparse` is non-zero, no part of *
+ * the range has been written yet, so runs of zeroes are skipped and *
+ * left as holes in the file                                         */
+void file_writer_write(struct file_writer *w, const void *data, size_t sz, size_t offset, int sparse);
+
+/* finish writing a file */
+void file_writer_close(struct file_writer *w);
+
 #endif /* Z64DECOMPRESS_FILE_H_INCLUDED */
 
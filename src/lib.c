@@ -0,0 +1,286 @@
+/*
+ * libz64decompress <z64.me>
+ *
+ * the rom and file decompression of the program, on buffers the
+ * caller provides; nothing here keeps state or dies, and the only
+ * allocation is the zlib decoder's scratch tables, for each file
+ *
+ */
+
+#include <string.h>
+
+#include "z64decompress.h"
+#include "decoder/decoder.h"
+#include "codec.h"
+#include "romview.h"
+#include "n64crc.h"
+
+/* big-endian bytes to u32 */
+static inline unsigned beU32(const void *bytes)
+{
+	const unsigned char *b = bytes;
+	return ((unsigned)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* write u32 as big-endian bytes */
+static inline void wbeU32(void *bytes, unsigned v)
+{
+	unsigned char *b = bytes;
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* a rom's dmadata and how its files are decompressed */
+struct rom_info
+{
+	const unsigned char *dma;
+	const unsigned char *dmaEnd;
+	Codec codec;          /* CODEC_NONE to detect each file's */
+	unsigned headerSkip;  /* bytes ahead of Pstart to decompress from */
+	size_t decSz;
+};
+
+/* find dmadata in a rom and size what it decompresses to */
+static int rom_info(struct rom_info *info, const void *rom, size_t romSz, const struct z64decompress_opts *opts)
+{
+	const unsigned char *dma;
+	size_t end;
+	int iQue;
+
+	info->codec = CODEC_NONE;
+	if (opts->codec && (info->codec = get_codec_type_from_name(opts->codec)) == CODEC_NONE)
+		return Z64DECOMPRESS_ERR_ARG;
+	if (opts->align & (opts->align - 1))
+		return Z64DECOMPRESS_ERR_ARG;
+
+	info->dma = dma_find(rom, romSz, opts->dmaOffset, &iQue);
+	if (!info->dma)
+		return Z64DECOMPRESS_ERR_NODMA;
+	info->dmaEnd = (const unsigned char *)rom + beU32(info->dma + STRIDE * IDX + 4);
+
+	/* iQue files are headerless, and zlib by default */
+	info->headerSkip = (opts->headerless || iQue) ? 8 : 0;
+	if (iQue && info->codec == CODEC_NONE)
+		info->codec = CODEC_ZLIB;
+
+	/* the decompressed rom has room for every file and dmadata itself */
+	end = info->dmaEnd - (const unsigned char *)rom;
+	for (dma = info->dma; dma < info->dmaEnd; dma += STRIDE)
+		if (dma_entry_valid(dma) && beU32(dma + 4) > end)
+			end = beU32(dma + 4);
+
+	/* and for everything n64crc() reads */
+	if (end < N64CRC_ROM_MIN)
+		end = N64CRC_ROM_MIN;
+	if (opts->align)
+		info->decSz = (end + opts->align - 1) & ~(opts->align - 1);
+	else
+		for (info->decSz = 1; info->decSz < end; info->decSz *= 2)
+			;
+
+	return Z64DECOMPRESS_OK;
+}
+
+/* decompress a file of a known codec into dstSz bytes of dst, *
+ * zeroing what the file doesn't fill; *sz is what it does      */
+static int decode(Codec codec, const void *src, size_t srcSz, void *dst, size_t dstSz, size_t *sz_)
+{
+	struct z64dec_ctx ctx;
+	size_t sz;
+
+	/* the whole file is in memory, and may be corrupt */
+	z64dec_ctx_init(&ctx, Z64DEC_FLAT | Z64DEC_SAFE);
+	ctx.dst_max = dstSz;
+
+	sz = decCodecInfo[codec].decode(&ctx, (void *)src, dst, srcSz);
+	if (!sz || sz > dstSz)
+		return Z64DECOMPRESS_ERR_DATA;
+
+	/* space the file doesn't fill reads as zeroes */
+	memset((unsigned char *)dst + sz, 0, dstSz - sz);
+
+	*sz_ = sz;
+	return Z64DECOMPRESS_OK;
+}
+
+/* fill in the default options: detect each codec, files have headers, *
+ * search for dmadata, and round up to the next power of two          */
+void z64decompress_opts_init(struct z64decompress_opts *opts)
+{
+	opts->codec = NULL;
+	opts->headerless = 0;
+	opts->dmaOffset = -1;
+	opts->align = 0;
+}
+
+/* size the decompressed rom will be, written to *decSz */
+int z64decompress_rom_size(const void *rom, size_t romSz, const struct z64decompress_opts *opts, size_t *decSz)
+{
+	struct z64decompress_opts defaults;
+	struct rom_info info;
+	int err;
+
+	if (!rom || !decSz)
+		return Z64DECOMPRESS_ERR_ARG;
+	if (!opts)
+	{
+		z64decompress_opts_init(&defaults);
+		opts = &defaults;
+	}
+
+	if ((err = rom_info(&info, rom, romSz, opts)))
+		return err;
+
+	*decSz = info.decSz;
+	return Z64DECOMPRESS_OK;
+}
+
+/* decompress a rom into dst, which has room for dstMax bytes and *
+ * must not overlap it; writes the size of the decompressed rom   *
+ * to *decSz, also on Z64DECOMPRESS_ERR_SPACE; opts may be NULL   *
+ * for the defaults                                               */
+int z64decompress_rom(const void *rom_, size_t romSz, void *dst, size_t dstMax, size_t *decSz, const struct z64decompress_opts *opts)
+{
+	const unsigned char *rom = rom_;
+	unsigned char *dec = dst;
+	struct z64decompress_opts defaults;
+	struct rom_info info;
+	const unsigned char *dma;
+	unsigned char *decDma;
+	int err;
+
+	if (!rom || !dst || !decSz)
+		return Z64DECOMPRESS_ERR_ARG;
+	if (!opts)
+	{
+		z64decompress_opts_init(&defaults);
+		opts = &defaults;
+	}
+
+	if ((err = rom_info(&info, rom, romSz, opts)))
+		return err;
+	*decSz = info.decSz;
+	if (dstMax < info.decSz)
+		return Z64DECOMPRESS_ERR_SPACE;
+
+	/* no file is transferred to the gaps between them; files are *
+	 * transferred in table order, so overlapping ones come out   *
+	 * the same as they would from the program                    */
+	memset(dec, 0, info.decSz);
+	for (dma = info.dma; dma < info.dmaEnd; dma += STRIDE)
+	{
+		unsigned Vstart = beU32(dma +  0); /* virtual addresses */
+		unsigned Vend   = beU32(dma +  4);
+		unsigned Pstart = beU32(dma +  8); /* physical addresses */
+		unsigned Pend   = beU32(dma + 12);
+		size_t sz = Vend - Vstart;
+		Codec codec;
+
+		/* unused or invalid entry */
+		if (!dma_entry_valid(dma))
+			continue;
+
+		/* not compressed */
+		if (!Pend)
+		{
+			if (Pstart > romSz || sz > romSz - Pstart)
+				return Z64DECOMPRESS_ERR_DATA;
+			memcpy(dec + Vstart, rom + Pstart, sz);
+			continue;
+		}
+
+		/* files are headerless, so what would be their header is just *
+		 * the 8 bytes before them                                     */
+		if (Pstart < info.headerSkip)
+			return Z64DECOMPRESS_ERR_DATA;
+		Pstart -= info.headerSkip;
+		if (Pend > romSz || Pend <= Pstart || Pend - Pstart < 4)
+			return Z64DECOMPRESS_ERR_DATA;
+
+		codec = info.codec;
+		if (codec == CODEC_NONE)
+			codec = get_codec_type_from_header(rom + Pstart);
+		if (codec == CODEC_NONE)
+			return Z64DECOMPRESS_ERR_CODEC;
+
+		if ((err = decode(codec, rom + Pstart, Pend - Pstart, dec + Vstart, sz, &sz)))
+			return err;
+	}
+
+	/* copy dmadata, with every file now where it is in the decompressed rom */
+	decDma = dec + (info.dma - rom);
+	memcpy(decDma, info.dma, info.dmaEnd - info.dma);
+	for (dma = info.dma; dma < info.dmaEnd; dma += STRIDE, decDma += STRIDE)
+	{
+		if (!dma_entry_valid(dma))
+			continue;
+		wbeU32(decDma +  8, beU32(dma));
+		wbeU32(decDma + 12, 0);
+	}
+
+	n64crc(dec);
+
+	return Z64DECOMPRESS_OK;
+}
+
+/* size an individual compressed file will decompress to, *
+ * as given in its header, written to *decSz              */
+int z64decompress_file_size(const void *src, size_t srcSz, size_t *decSz)
+{
+	if (!src || !decSz)
+		return Z64DECOMPRESS_ERR_ARG;
+
+	if (!(*decSz = z64dec_header_size(src, srcSz)))
+		return Z64DECOMPRESS_ERR_DATA;
+
+	return Z64DECOMPRESS_OK;
+}
+
+/* decompress an individual file into dst, which has room for dstMax   *
+ * bytes and must not overlap it; `codec` is as in z64decompress_opts; *
+ * writes the decompressed size to *decSz, also on                     *
+ * Z64DECOMPRESS_ERR_SPACE                                             */
+int z64decompress_file(const void *src, size_t srcSz, void *dst, size_t dstMax, size_t *decSz, const char *codecName)
+{
+	Codec codec = CODEC_NONE;
+	int err;
+
+	if (!dst || (codecName && (codec = get_codec_type_from_name(codecName)) == CODEC_NONE))
+		return Z64DECOMPRESS_ERR_ARG;
+
+	if ((err = z64decompress_file_size(src, srcSz, decSz)))
+		return err;
+	if (dstMax < *decSz)
+		return Z64DECOMPRESS_ERR_SPACE;
+
+	if (codec == CODEC_NONE)
+		codec = get_codec_type_from_header(src);
+	if (codec == CODEC_NONE)
+		return Z64DECOMPRESS_ERR_CODEC;
+
+	return decode(codec, src, srcSz, dst, *decSz, decSz);
+}
+
+/* description of a return code */
+const char *z64decompress_strerror(int err)
+{
+	switch (err)
+	{
+		case Z64DECOMPRESS_OK:
+			return "success";
+		case Z64DECOMPRESS_ERR_ARG:
+			return "invalid argument";
+		case Z64DECOMPRESS_ERR_NODMA:
+			return "failed to locate dmadata in rom";
+		case Z64DECOMPRESS_ERR_CODEC:
+			return "compressed file, unknown encoding";
+		case Z64DECOMPRESS_ERR_SPACE:
+			return "output buffer too small";
+		case Z64DECOMPRESS_ERR_DATA:
+			return "compressed data is invalid";
+	}
+
+	return "unknown error";
+}
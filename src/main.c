@@ -12,83 +12,174 @@
 #include <assert.h>
 
 #include "decoder/decoder.h"
+#include "codec.h"
+#include "romview.h"
+#include "bench.h"
+#include "verify.h"
+#include "stats.h"
+#include "cache.h"
+#include "arena.h"
 #include "n64crc.h"
 #include "file.h"
 #include "wow.h"
 
-#define STRIDE 16 /* bytes per dmadata entry */
-#define IDX    2  /* dmadata references itself at table[IDX] */
-#define STR32(X) (unsigned)((X[0]<<24)|(X[1]<<16)|(X[2]<<8)|X[3])
-#define DMA_DELETED 0xffffffff /* aka UINT32_MAX */
+#ifdef _WIN32
+ #include <io.h> /* _setmode */
+ #include <fcntl.h> /* _O_BINARY */
+#endif
 
-typedef enum {
-	CODEC_NONE = -1,
-	CODEC_YAZ0,
-	CODEC_LZO,
-	CODEC_UCL,
-	CODEC_APLIB,
-	CODEC_ZLIB,
-	CODEC_MAX
-} Codec;
+#define STR32(X) (unsigned)((X[0]<<24)|(X[1]<<16)|(X[2]<<8)|X[3])
+#define ROM_MIN N64CRC_ROM_MIN
 
+/* everything specific to the input being decompressed; batch mode *
+ * decompresses several inputs at once, each with its own RomState  */
 typedef struct {
-	const char *name; /* name used for program args */
-	const char *header; /* identifer used in the headers of compressed files */
-	size_t (*decode)(void *src, void *dst, size_t sz); /* decompression handler function */
-} CodecInfo;
-
-static CodecInfo decCodecInfo[CODEC_MAX] = {
-	[CODEC_YAZ0]  = { "yaz"  , "Yaz0", yazdec },
-	[CODEC_LZO]   = { "lzo"  , "LZO0", lzodec },
-	[CODEC_UCL]   = { "ucl"  , "UCL0", ucldec },
-	[CODEC_APLIB] = { "aplib", "APL0", apldec },
-	[CODEC_ZLIB ] = { "zlib" , "ZLIB", zlibdec },
-};
+	// non-zero if iQue edition
+	char iQue;
 
-// non-zero if iQue edition
-static char iQue = 0;
+	// non-zero if files are headerless
+	char headerlessFlag;
 
-// non-zero if files are headerless
-static char headerlessFlag = 0;
+	// This points to an array detailing whether each file in the rom is compressed or not.
+	// This allows us to print the arguments that should be passed to the z64compress to recompress the rom.
+	// 0 = uncompressed, 1 = compressed, -1 = terminator
+	signed char *fileIsCompressed;
 
-// This points to an array detailing whether each file in the rom is compressed or not.
-// This allows us to print the arguments that should be passed to the z64compress to recompress the rom.
-// 0 = uncompressed, 1 = compressed, -1 = terminator
-static signed char *fileIsCompressed;
+	// Codec of each file alongside fileIsCompressed (CODEC_NONE if not compressed),
+	// so the z64compress args hold up however many codecs or threads were involved
+	signed char *fileCodec;
 
-// Save the start of dma data for the z64compress args
-static unsigned dmaStartArg = 0; 
+	// Save the start of dma data for the z64compress args
+	unsigned dmaStartArg;
 
-// Save the last used codec for the z64compress args
-static Codec lastUsedCodec = CODEC_NONE;
+	// Number of threads used for transferring files from comp to dec
+	int numThreads;
 
-Codec get_codec_type_from_name(const char *name)
-{
-	for (int i = 0; i < CODEC_MAX; i++)
-	{
-		if (!strcmp(name, decCodecInfo[i].name))
-		{
-			return (Codec)i;
-		}
-	}
-	return CODEC_NONE;
-}
+	// If non-null, the decompressed rom is mapped directly onto this file
+	const char *decMapName;
 
-Codec get_codec_type_from_header(const void *header) {
-    for (int i = 0; i < CODEC_MAX; i++)
-    {
-        if (!memcmp(decCodecInfo[i].header, header, 4))
-        {
-            return (Codec)i;
-        }
-    }
-    return CODEC_NONE;
-}
+	// If non-null, the decompressed rom is written to this file a file at a time,
+	// each as soon as it's finished, by decWriter
+	const char *decWriteName;
+	struct file_writer *decWriter;
+
+	// Start of the decompressed rom, when it's in decBuf
+	unsigned char *decBase;
+
+	// If non-null, files are looked up in the previous output and its
+	// sidecar (--cache), and the entries of a new sidecar are collected
+	const char *cacheName;
+	struct dec_cache *cache;
+	struct dec_cache_entry *cacheEntry;
+	int cacheEntryNum;
+
+	// If non-null, the input is still being read into compBuf by this
+	// loader, and each file is transferred as soon as its bytes are in
+	struct file_loader *loader;
+
+	// Per-input metadata (file info, job lists), given back all at once
+	// between inputs so the memory is reused rather than freed
+	struct arena arena;
+
+	// Buffers and decoder state, kept around for the next input
+	void *decBuf;
+	size_t decBufSz;
+	void *compBuf;
+	size_t compBufSz;
+	struct z64dec_ctx ctx;
+
+	// Where the time went, for --stats
+	RomStats stats;
+} RomState;
+
+// Number of threads used for decompressing (split between inputs in batch mode)
+static int numThreads = 1;
+
+// Granularity the decompressed rom size is rounded up to (0 = power of two)
+static size_t romAlign = 0;
+
+// flag that determines if individual files are decompressed or a whole rom
+static int individualFlag = 0;
+
+// flag that determines if files are headerless (iQue roms always are)
+static int headerlessArg = 0;
+
+// flag that determines if dmaext hack is used
+static int dmaExtFlag = 0;
+
+// flag that determines if files are mapped rather than loaded
+static int mmapFlag = 0;
+
+// codec to use rather than autodetecting it (for use with decCodecInfo.name)
+static Codec codecType = CODEC_NONE;
+
+// rom offset of dmadata, if given rather than searched for (-1 = search)
+static long dmaOffsetArg = -1;
+
+// dmadata entries to extract on their own (--extract), or NULL
+static const char *extractArg = NULL;
+
+// flag that determines if a report on where the time went is printed
+static int statsFlag = 0;
+
+// if non-null, the same report is written here as JSON (--stats-json)
+static FILE *statsJson = NULL;
+
+// flag that determines if files unchanged since the previous output are reused
+static int cacheFlag = 0;
+
+/* size of the z64ext header ahead of some dmaext files */
+#define Z64EXT_HEADER 0x10
+
+/* the decoder for each codec, in Codec order */
+#define JOB_CODECS(X) \
+	X(YAZ0, yazdec_ctx) \
+	X(LZO, lzodec_ctx) \
+	X(UCL, ucldec_ctx) \
+	X(APLIB, apldec_ctx) \
+	X(ZLIB, zlibdec_ctx)
+
+/* how a file is transferred: copied, or decompressed with a given *
+ * codec, with or without a z64ext header ahead of it              */
+typedef enum {
+	JOB_COPY,
+	JOB_CACHED,       /* already read back from the previous output */
+#define X(CODEC, DECODE) JOB_##CODEC, JOB_##CODEC##_EXT,
+	JOB_CODECS(X)
+#undef X
+} DmaJobKind;
+
+/* a single file queued for transfer from comp to dec */
+typedef struct {
+	unsigned char *dst;
+	unsigned char *src;
+	size_t sz;        /* compressed size, or number of bytes to copy */
+	size_t dstSz;     /* room available at dst, used for overlap checks */
+	size_t headerSz;  /* bytes copied as-is ahead of the compressed data */
+	int compressed;   /* non-zero if src must be decompressed */
+	Codec codec;      /* codec the file is decompressed with */
+	DmaJobKind kind;  /* how to transfer it, from codec and headerSz */
+	int entry;        /* index into fileIsCompressed and fileCodec */
+	double time;      /* seconds it took to transfer */
+	struct dec_cache_entry *cache; /* sidecar entry to hash dst into, if any */
+} DmaJob;
+
+/* list of files shared by every thread transferring them */
+typedef struct {
+	DmaJob **order;   /* jobs in the order they are handed out */
+	int jobNum;
+	int next;         /* next index into order[] to be claimed */
+	struct file_writer *out; /* where finished files are written, if anywhere */
+	unsigned char *outBase;  /* start of the rom being written */
+	int sparse;       /* non-zero if no two files overlap */
+	RomState *st;     /* the input the files are from */
+	Codec codecOverride; /* codec of every compressed file, if not CODEC_NONE */
+} DmaJobQueue;
 
 /* big-endian bytes to u32 */
-static inline unsigned beU32(void *bytes)
+static inline unsigned beU32(const void *bytes)
 {
-	unsigned char *b = bytes;
+	const unsigned char *b = bytes;
 	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
 }
 
@@ -102,39 +193,436 @@ static inline void wbeU32(void *bytes, unsigned v)
 	b[3] = v;
 }
 
-/* decompress a file (returns non-zero if unknown codec) */
-static size_t decompress(void *dst, void *src, size_t sz, Codec codecOverride)
+/* decompress a file from comp to dec; each codec and header mode *
+ * gets its own copy, calling its decoder directly; the decoder is *
+ * kept within the file's range in dec even if its header says     *
+ * it's bigger, so files decoded in parallel never write over one  *
+ * another                                                         */
+#define TRANSFER_DECODE(KIND, DECODE, HEADER_SZ) \
+static void transfer_##KIND(struct z64dec_ctx *ctx, DmaJob *job) \
+{ \
+	size_t sz = HEADER_SZ; \
+	\
+	if (job->dstSz <= HEADER_SZ) \
+		die("ERROR: dma entry %d has no room for its z64ext header", job->entry); \
+	memcpy(job->dst, job->src, HEADER_SZ); \
+	ctx->dst_max = job->dstSz - HEADER_SZ; \
+	sz += DECODE(ctx, job->src + HEADER_SZ, job->dst + HEADER_SZ, job->sz); \
+	ctx->dst_max = 0; \
+	\
+	if (sz == HEADER_SZ) \
+		die("ERROR: failed to decompress dma entry %d", job->entry); \
+	\
+	/* space the file doesn't fill reads as zeroes */ \
+	if (sz < job->dstSz) \
+	{ \
+		fprintf(stderr, "warning: dma entry %d decompressed to 0x%X bytes, " \
+			"short of its 0x%X\n", job->entry, (unsigned)sz, (unsigned)job->dstSz); \
+		memset(job->dst + sz, 0, job->dstSz - sz); \
+	} \
+}
+#define X(CODEC, DECODE) \
+	TRANSFER_DECODE(CODEC, DECODE, 0) \
+	TRANSFER_DECODE(CODEC##_EXT, DECODE, Z64EXT_HEADER)
+JOB_CODECS(X)
+#undef X
+#undef TRANSFER_DECODE
+
+/* transfer a single file from comp to dec */
+static void transfer_job(struct z64dec_ctx *ctx, DmaJob *job)
 {
-	Codec codecHeader;
+	double start = wow_time();
+	
+	switch (job->kind)
+	{
+		case JOB_COPY:
+			memcpy(job->dst, job->src, job->sz);
+			break;
+		case JOB_CACHED:
+			break;
+#define X(CODEC, DECODE) \
+		case JOB_##CODEC: transfer_##CODEC(ctx, job); break; \
+		case JOB_##CODEC##_EXT: transfer_##CODEC##_EXT(ctx, job); break;
+		JOB_CODECS(X)
+#undef X
+	}
+	
+	/* remember what it decompressed to for the next run */
+	if (job->cache && job->kind != JOB_CACHED)
+		job->cache->decHash = dec_cache_hash(job->dst, job->dstSz);
+	
+	job->time = wow_time() - start;
+}
 
-	assert(src != NULL);
-	assert(dst != NULL);
-	assert(sz != 0);
+/* write a finished file out, if the rom is written a file at a time */
+static void write_job(DmaJobQueue *q, DmaJob *job)
+{
+	if (!q->out)
+		return;
+	
+	/* zeroes left by overlapping files may cover earlier writes */
+	file_writer_write(q->out, job->dst, job->dstSz, job->dst - q->outBase, q->sparse);
+}
+
+/* work out how a file is transferred, recording its codec in st->fileCodec */
+static void detect_codec(RomState *st, DmaJob *j, Codec codecOverride)
+{
+	j->kind = JOB_COPY;
+	if (!j->compressed)
+		return;
+	
+	j->codec = codecOverride;
+	if (j->codec == CODEC_NONE)
+		j->codec = get_codec_type_from_header(j->src + j->headerSz);
+	if (j->codec == CODEC_NONE)
+		die("ERROR: compressed file, unknown encoding (dma entry %d)", j->entry);
+	
+	/* kinds come in pairs, in Codec order */
+	j->kind = JOB_YAZ0 + j->codec * 2 + (j->headerSz != 0);
+	st->fileCodec[j->entry] = j->codec;
+}
 
-	/* override codec if requested rather than autodetecting it */
-	if (codecOverride != CODEC_NONE)
+/* wait for a file's bytes to be read in, if they're still being read */
+static void load_job(DmaJobQueue *q, DmaJob *job)
+{
+	RomState *st = q->st;
+	
+	if (!st->loader)
+		return;
+	
+	file_loader_wait(st->loader, job->src + job->headerSz + job->sz - (unsigned char *)st->compBuf);
+	detect_codec(st, job, q->codecOverride);
+}
+
+/* claim and transfer files until none are left */
+static void job_worker(void *udata)
+{
+	DmaJobQueue *q = udata;
+	struct z64dec_ctx ctx;
+	int i;
+	
+	/* the whole rom is in memory, and only safe mode holds *
+	 * every decoder to dst_max                             */
+	z64dec_ctx_init(&ctx, Z64DEC_FLAT | Z64DEC_SAFE);
+	
+	while ((i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->jobNum)
 	{
-		/* save the last used codec for the z64compress args */
-		lastUsedCodec = codecOverride;
-		return decCodecInfo[codecOverride].decode(src, dst, sz);
+		load_job(q, q->order[i]);
+		transfer_job(&ctx, q->order[i]);
+		write_job(q, q->order[i]);
 	}
+}
 
-	/* the codec header is the first 4 bytes of the file */
-	codecHeader = get_codec_type_from_header(src);
+/* qsort callbacks for job lists */
+static int cmp_job_kind_size(const void *a, const void *b)
+{
+	const DmaJob *ja = *(DmaJob * const *)a;
+	const DmaJob *jb = *(DmaJob * const *)b;
+	
+	/* files transferred the same way are handed out together, so *
+	 * each thread sticks to one decoder for as long as possible   */
+	if (ja->kind != jb->kind)
+		return (ja->kind > jb->kind) - (ja->kind < jb->kind);
+	
+	/* largest first, so small files fill in the gaps at the end */
+	return (ja->sz < jb->sz) - (ja->sz > jb->sz);
+}
+static int cmp_job_kind_dst(const void *a, const void *b)
+{
+	const DmaJob *ja = *(DmaJob * const *)a;
+	const DmaJob *jb = *(DmaJob * const *)b;
+	
+	if (ja->kind != jb->kind)
+		return (ja->kind > jb->kind) - (ja->kind < jb->kind);
+	
+	return (ja->dst > jb->dst) - (ja->dst < jb->dst);
+}
+static int cmp_job_dst(const void *a, const void *b)
+{
+	const DmaJob *ja = *(DmaJob * const *)a;
+	const DmaJob *jb = *(DmaJob * const *)b;
+	
+	return (ja->dst > jb->dst) - (ja->dst < jb->dst);
+}
+static int cmp_job_src_end(const void *a, const void *b)
+{
+	const DmaJob *ja = *(DmaJob * const *)a;
+	const DmaJob *jb = *(DmaJob * const *)b;
+	const unsigned char *ea = ja->src + ja->headerSz + ja->sz;
+	const unsigned char *eb = jb->src + jb->headerSz + jb->sz;
+	
+	return (ea > eb) - (ea < eb);
+}
 
-	if (codecHeader != CODEC_NONE)
+/* work out how every file is transferred before any are, *
+ * recording the codec of each in st->fileCodec           */
+static void detect_codecs(RomState *st, DmaJob *job, int jobNum, Codec codecOverride)
+{
+	int i;
+	
+	for (i = 0; i < jobNum; ++i)
+		detect_codec(st, job + i, codecOverride);
+}
+
+/* sidecars record each file's codec by name, zero-padded */
+_Static_assert(CODEC_NAME_MAX <= DEC_CACHE_CODEC, "codec names must fit DEC_CACHE_CODEC");
+
+/* list every compressed file in a new sidecar, reading the ones *
+ * that haven't changed back out of the previous output           */
+static void cache_jobs(RomState *st, DmaJob *job, int jobNum)
+{
+	int i;
+	
+	st->cacheEntry = arena_alloc(&st->arena, sizeof(*st->cacheEntry) * (jobNum + 1));
+	st->cacheEntryNum = 0;
+	
+	for (i = 0; i < jobNum; ++i)
 	{
-		/* save the last used codec for the z64compress args */
-		lastUsedCodec = codecHeader;
-		return decCodecInfo[codecHeader].decode(src, dst, sz);
+		DmaJob *j = job + i;
+		struct dec_cache_entry *e;
+		
+		if (!j->compressed)
+			continue;
+		
+		e = st->cacheEntry + st->cacheEntryNum++;
+		e->srcSz = j->headerSz + j->sz;
+		e->srcHash = dec_cache_hash(j->src, e->srcSz);
+		e->offset = j->dst - st->decBase;
+		e->decSz = j->dstSz;
+		e->headerSz = j->headerSz;
+		memset(e->codec, 0, sizeof(e->codec));
+		memcpy(e->codec, decCodecInfo[j->codec].name, strlen(decCodecInfo[j->codec].name));
+		j->cache = e;
+		
+		if (st->cache
+			&& dec_cache_fetch(st->cache, e->srcHash, e->srcSz, e->codec
+				, e->headerSz, j->dst, j->dstSz, &e->decHash
+			)
+		)
+			j->kind = JOB_CACHED;
 	}
+}
 
-	die("ERROR: compressed file, unknown encoding");
-	return 0;
+/* transfer every file in the list, using st->numThreads threads if possible */
+static void transfer_jobs(RomState *st, DmaJob *job, int jobNum, Codec codecOverride)
+{
+	DmaJobQueue q = { NULL, jobNum, 0, st->decWriter, st->decBase, 1, st, codecOverride };
+	wow_thread *threads;
+	int threadNum = st->numThreads;
+	double start = wow_time();
+	int overlap = 0;
+	int i;
+	
+	if (threadNum > jobNum)
+		threadNum = jobNum;
+	
+	q.order = arena_alloc(&st->arena, sizeof(*q.order) * (jobNum + 1));
+	for (i = 0; i < jobNum; ++i)
+		q.order[i] = job + i;
+	
+	/* files that overlap in dec must be written in table order */
+	qsort(q.order, jobNum, sizeof(*q.order), cmp_job_dst);
+	for (i = 1; i < jobNum && !overlap; ++i)
+		if (q.order[i - 1]->dst + q.order[i - 1]->dstSz > q.order[i]->dst)
+			overlap = 1;
+	if (overlap)
+	{
+		q.sparse = 0;
+		threadNum = 1;
+		for (i = 0; i < jobNum; ++i)
+			q.order[i] = job + i;
+	}
+	
+	/* while the input is still being read, files are handed out in *
+	 * the order their bytes arrive, and how each is transferred is  *
+	 * worked out once they have                                     */
+	if (!st->loader)
+		detect_codecs(st, job, jobNum, codecOverride);
+	else if (!overlap)
+		qsort(q.order, jobNum, sizeof(*q.order), cmp_job_src_end);
+	
+	/* what a file decompressed to may have been overwritten since, *
+	 * so roms with overlapping files aren't cached                  */
+	for (i = 0; i < jobNum; ++i)
+		job[i].cache = NULL;
+	if (st->cacheName && !overlap)
+		cache_jobs(st, job, jobNum);
+	else
+		st->cacheName = NULL;
+	dec_cache_free(st->cache);
+	st->cache = NULL;
+	
+	if (threadNum <= 1)
+	{
+		/* otherwise each decoder gets through all its files at once */
+		if (!overlap && !st->loader)
+			qsort(q.order, jobNum, sizeof(*q.order), cmp_job_kind_dst);
+		
+		threadNum = 1;
+		for (i = 0; i < jobNum; ++i)
+		{
+			load_job(&q, q.order[i]);
+			transfer_job(&st->ctx, q.order[i]);
+			write_job(&q, q.order[i]);
+		}
+	}
+	else
+	{
+		/* balance the load by handing out the biggest files first */
+		if (!st->loader)
+			qsort(q.order, jobNum, sizeof(*q.order), cmp_job_kind_size);
+		
+		/* this thread works alongside the others */
+		threads = arena_alloc(&st->arena, sizeof(*threads) * threadNum);
+		for (i = 1; i < threadNum; ++i)
+			if (wow_thread_create(&threads[i], job_worker, &q))
+				die("ERROR: failed to create thread");
+		job_worker(&q);
+		for (i = 1; i < threadNum; ++i)
+			wow_thread_join(threads[i]);
+	}
+	
+	/* record where the time went */
+	st->stats.transfer += wow_time() - start;
+	st->stats.threads = threadNum;
+	for (i = 0; i < jobNum; ++i)
+	{
+		if (job[i].kind == JOB_CACHED)
+		{
+			st->stats.cached.num++;
+			st->stats.cached.in += job[i].headerSz + job[i].sz;
+			st->stats.cached.out += job[i].dstSz;
+			continue;
+		}
+		stats_file(&st->stats, job[i].entry
+			, job[i].compressed ? job[i].codec : CODEC_NONE
+			, job[i].headerSz + job[i].sz, job[i].dstSz, job[i].time
+		);
+	}
+}
+
+/* allocate per-file info for a rom with up to `num` dma entries */
+static void alloc_file_info(RomState *st, int num)
+{
+	/* add one for the terminator */
+	st->fileIsCompressed = arena_calloc(&st->arena, num + 1, sizeof(*st->fileIsCompressed));
+	st->fileCodec = arena_alloc(&st->arena, num + 1);
+	memset(st->fileCodec, CODEC_NONE, num + 1);
+}
+
+/* size of a decompressed rom whose files end at `end` */
+static size_t dec_size(size_t end)
+{
+	size_t sz;
+	
+	if (end < ROM_MIN)
+		end = ROM_MIN;
+	
+	if (romAlign)
+		return (end + romAlign - 1) & ~(romAlign - 1);
+	
+	for (sz = 1; sz < end; sz *= 2)
+		;
+	
+	return sz;
+}
+
+/* make sure a reusable buffer holds at least `sz` bytes */
+static void *grow_buf(void **buf, size_t *bufSz, size_t sz)
+{
+	if (*bufSz < sz)
+	{
+		/* the old contents needn't survive, so skip realloc's copy */
+		free(*buf);
+		*buf = malloc_safe(sz);
+		*bufSz = sz;
+	}
+	
+	return *buf;
+}
+
+/* allocate the decompressed rom; its contents are left undefined, *
+ * for zero_gaps() and the file transfers to fill in               */
+static void *alloc_dec(RomState *st, size_t dstSz)
+{
+	if (st->decMapName)
+		return file_map_new(st->decMapName, dstSz);
+	
+	/* files are written out as they finish, so the gaps *
+	 * between them needn't be written at all            */
+	if (st->decWriteName)
+		st->decWriter = file_writer_open(st->decWriteName, dstSz);
+	
+	st->decBase = grow_buf(&st->decBuf, &st->decBufSz, dstSz);
+	return st->decBase;
+}
+
+/* write out what changed after the files were written, if the rom *
+ * is written a file at a time: the checksum, and dmadata          */
+static void write_back(RomState *st, size_t offset, size_t sz)
+{
+	if (st->decWriter)
+		file_writer_write(st->decWriter, st->decBase + offset, sz, offset, 0);
+}
+
+/* zero the parts of dec that no file is transferred to */
+static void zero_gaps(RomState *st, unsigned char *dec, size_t decSz, DmaJob *job, int jobNum)
+{
+	DmaJob **order = arena_alloc(&st->arena, sizeof(*order) * (jobNum + 1));
+	unsigned char *end = dec;
+	int i;
+	
+	for (i = 0; i < jobNum; ++i)
+		order[i] = job + i;
+	qsort(order, jobNum, sizeof(*order), cmp_job_dst);
+	
+	for (i = 0; i < jobNum; ++i)
+	{
+		DmaJob *j = order[i];
+		
+		if (j->dst > end)
+			memset(end, 0, j->dst - end);
+		if (j->dst + j->dstSz > end)
+			end = j->dst + j->dstSz;
+	}
+	if (dec + decSz > end)
+		memset(end, 0, dec + decSz - end);
+}
+
+/* it is expected that dmaext dmadata will start with this entry */
+static const unsigned char dmaExtStartMagic[] = {
+	0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x10, 0x60,
+	0x00, 0x00, 0x10, 0x61,
+};
+
+/* find the start of dmaext dmadata in rom (returns NULL if not found) */
+static unsigned char *find_dmaext(unsigned char *rom, size_t romSz)
+{
+	size_t offset;
+	
+	/* the user knows where it is */
+	if (dmaOffsetArg >= 0)
+	{
+		offset = dmaOffsetArg;
+		if (offset + 32 >= romSz || memcmp(rom + offset, dmaExtStartMagic, sizeof(dmaExtStartMagic)))
+			die("ERROR: no dmaext dmadata at 0x%X", (unsigned)offset);
+		return rom + offset;
+	}
+	
+	/* test one word of each entry before comparing the whole thing */
+	for (offset = 0; offset + 32 < romSz; offset += 0x10)
+		if (beU32(rom + offset + 4) == 0x00000001
+			&& !memcmp(rom + offset, dmaExtStartMagic, sizeof(dmaExtStartMagic))
+		)
+			return rom + offset;
+	
+	return NULL;
 }
 
 /* decompress rom that uses the ZZRTL dmaext hack (returns pointer to decompressed rom) */
-static inline void *romdec_dmaext(unsigned char *rom, size_t romSz, size_t *dstSz, Codec codecOverride)
+static inline void *romdec_dmaext(RomState *st, unsigned char *rom, size_t romSz, size_t *dstSz, Codec codecOverride)
 {
 	#define COMPRESSED (1 << 31)
 	#define OVERLAP (1 <<  0)
@@ -154,9 +642,9 @@ static inline void *romdec_dmaext(unsigned char *rom, size_t romSz, size_t *dstS
 	unsigned char *dmaCur;
 	unsigned char *dec; // decompressed rom in ram
 	int dmaNum; // used for writing to fileIsCompressed
-
-	/* ensure that dstSz is at least the size of the rom itself, but we will correct the value later */
-	*dstSz = romSz;
+	DmaJob *job; // files queued for transfer
+	size_t end = 0; // end of the last file in dec
+	double start; // for --stats
 
 	/* check to make sure a codec is provided since with dmaext the autodetection will fail */
 	if (codecOverride == CODEC_NONE)
@@ -166,35 +654,22 @@ static inline void *romdec_dmaext(unsigned char *rom, size_t romSz, size_t *dstS
 	}
 	
 	/* find dmadata in rom */
-	for (dmaCur = rom; (unsigned)(dmaCur - rom) < romSz - 32; dmaCur += 0x10)
-	{
-		/* it is expected that dmaext dmadata will start with this entry */
-		static unsigned char dmaExtStartMagic[] = {
-			0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x01,
-			0x00, 0x00, 0x10, 0x60,
-			0x00, 0x00, 0x10, 0x61,
-		};
-
-		/* check if the magic value is found */
-		if (!memcmp(dmaCur, dmaExtStartMagic, sizeof(dmaExtStartMagic)))
-		{
-			/* found the start */
-			dmaStart = dmaCur;
-
-			/* dmadata is confirmed to be found, now let's find the end of dmadata */
-			/* we will also determine the end of the rom in this loop by finding the
-			   largest decompressed end address of all the files */
-			for (dmaCur = dmaStart, Traverse(dmaCur); Vstart(dmaCur) != 0; Traverse(dmaCur))
-			{
-				/* determine the "distal" end of the rom */
-				if (*dstSz < Vend(dmaCur)) {
-					*dstSz *= 2;
-				}
+	start = wow_time();
+	dmaStart = find_dmaext(rom, romSz);
+	st->stats.search += wow_time() - start;
+	if (dmaStart)
+	{
+		/* dmadata is confirmed to be found, now let's find the end of dmadata */
+		/* we will also determine the end of the rom in this loop by finding the
+		   largest decompressed end address of all the files */
+		for (dmaCur = dmaStart, Traverse(dmaCur); Vstart(dmaCur) != 0; Traverse(dmaCur))
+		{
+			/* determine the "distal" end of the rom */
+			if (end < Vend(dmaCur)) {
+				end = Vend(dmaCur);
 			}
-			dmaEnd = dmaCur;
-			break;
 		}
+		dmaEnd = dmaCur;
 	}
 
 	/* check if the start and end of dmadata was found */
@@ -208,76 +683,107 @@ static inline void *romdec_dmaext(unsigned char *rom, size_t romSz, size_t *dstS
 
 	/* since we now know where the end of dmadata is, we can allocate the list of
 		compressed and uncompressed files for printing the z64compress args later. */
-	/* Add one for the terminator */
-	fileIsCompressed = calloc(1, sizeof(signed char) * (((dmaEnd - dmaStart) / 4) + 1));
+	alloc_file_info(st, (dmaEnd - dmaStart) / 4);
 
-	/* allocate decompressed rom */
-	dec = calloc_safe(*dstSz, 1);
+	/* allocate decompressed rom, with room for dmadata itself */
+	if (end < (size_t)(dmaEnd - rom))
+		end = dmaEnd - rom;
+	*dstSz = dec_size(end);
+	start = wow_time();
+	dec = alloc_dec(st, *dstSz);
+	st->stats.alloc += wow_time() - start;
+
+	/* each entry is at least two words long */
+	job = arena_alloc(&st->arena, sizeof(*job) * (((dmaEnd - dmaStart) / 8) + 1));
 
-	/* transfer files from comp to dec, and decompress them if needed */
+	/* queue files for transfer from comp to dec, decompressing them if needed */
 	for (dmaNum = 0, dmaCur = dmaStart; dmaCur < dmaEnd; dmaNum++) 
 	{
+		DmaJob *j = job + dmaNum;
+		
+		j->dstSz = Vend(dmaCur) - Vstart(dmaCur);
+		j->headerSz = 0;
+		j->compressed = Pbits(dmaCur) & COMPRESSED;
+		j->codec = CODEC_NONE;
+		j->entry = dmaNum;
+		
+		/* a compressed file starts with the word holding its size */
+		if (Pstart(dmaCur) > romSz || Vend(dmaCur) < Vstart(dmaCur)
+			|| ((Pbits(dmaCur) & COMPRESSED)
+				&& romSz - Pstart(dmaCur) < ((Pbits(dmaCur) & HEADER) ? Z64EXT_HEADER : 0) + 4)
+		)
+			die("ERROR: dma entry %d is outside the rom", dmaNum);
+		
 		/* if file is compressed, decompress it! */
 		if (Pbits(dmaCur) & COMPRESSED)
 		{
             if (Pbits(dmaCur) & HEADER)
             {
-                /* copy z64ext header */
-                memmove(dec + Vstart(dmaCur), rom + Pstart(dmaCur), 0x10);
-
-                /* decompress file while accounting for the header*/
-                decompress(
-                    dec + Vstart(dmaCur) + 0x10, /* dst */
-                    rom + Pstart(dmaCur) + 0x10, /* src */
-                    beU32(rom + Pstart(dmaCur) + 0x10), /* sz */
-                    codecOverride
-                );
+                /* copy z64ext header, then decompress the file after it */
+                j->dst = dec + Vstart(dmaCur);
+                j->src = rom + Pstart(dmaCur);
+                j->sz = beU32(rom + Pstart(dmaCur) + Z64EXT_HEADER);
+                j->headerSz = Z64EXT_HEADER;
             }
 			else
 			{
 				/* no z64ext header */
-				decompress(
-					dec + Vstart(dmaCur), /* dst */
-					rom + Pstart(dmaCur), /* src */
-					beU32(rom + Pstart(dmaCur)), /* sz */
-					codecOverride
-				);
+				j->dst = dec + Vstart(dmaCur);
+				j->src = rom + Pstart(dmaCur);
+				j->sz = beU32(rom + Pstart(dmaCur));
 			}
 		}
 		else
 		{
 			/* not compressed */
-			memcpy(dec + Vstart(dmaCur), rom + Pstart(dmaCur), Vend(dmaCur) - Vstart(dmaCur));
+			j->dst = dec + Vstart(dmaCur);
+			j->src = rom + Pstart(dmaCur);
+			j->sz = Vend(dmaCur) - Vstart(dmaCur);
 		}
+		if (j->sz > romSz - Pstart(dmaCur) - j->headerSz)
+			die("ERROR: dma entry %d is outside the rom", dmaNum);
+
+		/* update the compressed info (before the entry is rewritten) */
+		st->fileIsCompressed[dmaNum] = j->compressed ? 1 : 0;
 
 		/* Update dma entries */
 		wbeU32(dmaCur + (4 * 1), (Pbits(dmaCur) & (OVERLAP | HEADER)) | Vstart(dmaCur));
 
 		/* find the next dma table entry */
 		Traverse(dmaCur);
-
-		/* update the compressed info */
-		fileIsCompressed[dmaNum] = (Pbits(dmaCur) & COMPRESSED) ? 1 : 0;
 	}
 
+	/* dmaext doesn't record compressed sizes, so there's no telling *
+	 * whether a file changed, and nothing can be cached              */
+	st->cacheName = NULL;
+
+	/* transfer files from comp to dec */
+	zero_gaps(st, dec, *dstSz, job, dmaNum);
+	transfer_jobs(st, job, dmaNum, codecOverride);
+
 	/* write the terminator */
-	fileIsCompressed[dmaNum] = -1;
+	st->fileIsCompressed[dmaNum] = -1;
 
 	/* copy modified dmadata to decompressed rom */
 	memcpy(dec + (dmaStart - rom), dmaStart, dmaEnd - dmaStart);
 	
 	/* update crc */
+	start = wow_time();
 	n64crc(dec);
+	st->stats.crc += wow_time() - start;
+	
+	write_back(st, dmaStart - rom, dmaEnd - dmaStart);
+	write_back(st, N64CRC_OFFSET, N64CRC_SIZE);
 	
 	/* set the start of dmadata for the z64compress args */
-	dmaStartArg = dmaStart - rom;
+	st->dmaStartArg = dmaStart - rom;
 
 	/* return the pointer to the decompressed rom */
 	return dec;
 }
 
 /* decompress rom (returns pointer to decompressed rom) */
-static inline void *romdec(void *rom, size_t romSz, size_t *dstSz, Codec codecOverride)
+static inline void *romdec(RomState *st, void *rom, size_t romSz, size_t *dstSz, Codec codecOverride)
 {
 	unsigned char *comp = rom; /* compressed rom */
 	unsigned char *dec;
@@ -286,153 +792,232 @@ static inline void *romdec(void *rom, size_t romSz, size_t *dstSz, Codec codecOv
 	unsigned char *dmaEnd = 0;
 	unsigned dmaNum = 0;
 	int dmaCur; // used for writing to fileIsCompressed
+	DmaJob *job; // files queued for transfer
+	int jobNum;
+	size_t end; // end of the last file in dec
+	int iQue;
+	unsigned headerSkip; // bytes ahead of Pstart to decompress from
+	double start; // for --stats
 	
-	/* find dmadata in rom */
-	dmaStart = 0;
-	for (dma = comp; (unsigned)(dma - comp) < romSz - 32; dma += 16)
-	{
-		/* table always starts like so */
-		static const unsigned char dmaStartMagic[] = {
-			0x00,0x00,0x00,0x00   /* Vstart */
-			, 0x00,0x00,0x10,0x60 /* Vend   */
-			, 0x00,0x00,0x00,0x00 /* Pstart */
-			, 0x00,0x00,0x00,0x00 /* Pend   */
-			, 0x00,0x00,0x10,0x60 /* Vstart (next) */
-		};
-		/* iQue has the hard-coded value x1050 instead of x1060 */
-		static const unsigned char dmaStartiQue[] = {
-			0x00,0x00,0x00,0x00   /* Vstart */
-			, 0x00,0x00,0x10,0x50 /* Vend   */
-			, 0x00,0x00,0x00,0x00 /* Pstart */
-			, 0x00,0x00,0x00,0x00 /* Pend   */
-			, 0x00,0x00,0x10,0x50 /* Vstart (next) */
-		};
-
-		/* data matches iQue */
-		iQue = !memcmp(dma, dmaStartiQue, sizeof(dmaStartiQue));
-		if (iQue)
-			headerlessFlag = 1;
-
-		/* data doesn't match */
-		if (!iQue && memcmp(dma, dmaStartMagic, sizeof(dmaStartMagic)))
-			continue;
-		
-		/* table[IDX].Vstart isn't current rom offset */
-		if (beU32(dma + STRIDE * IDX) != (unsigned)(dma - comp))
-			continue;
-		
-		/* all tests passed; this is dmadata */
-		dmaStart = dma;
-		dmaNum = (beU32(dma + STRIDE * IDX + 4) - (dma - comp)) / STRIDE;
-		dmaEnd = dmaStart + dmaNum * STRIDE;
-
-		/* since we now know how many dma entries there are, we can allocate the list of
-		   compressed and uncompressed files for printing the z64compress args later. */
-		/* Add one for the terminator */
-		fileIsCompressed = calloc(1, sizeof(signed char) * (dmaNum + 1));
-		break;
+	/* find dmadata in rom; while it's still being read, look in *
+	 * the start of it before waiting for the rest               */
+	start = wow_time();
+	dmaStart = NULL;
+	if (st->loader && romSz > ROM_MIN)
+	{
+		file_loader_wait(st->loader, ROM_MIN);
+		dmaStart = dma_find(comp, ROM_MIN, dmaOffsetArg, &iQue);
+	}
+	if (!dmaStart)
+	{
+		if (st->loader)
+			file_loader_wait(st->loader, romSz);
+		dmaStart = dma_find(comp, romSz, dmaOffsetArg, &iQue);
 	}
+	st->iQue = iQue;
+	st->stats.search += wow_time() - start;
 	
 	/* failed to locate dmadata in rom */
+	if (!dmaStart && dmaOffsetArg >= 0)
+		die("ERROR: no dmadata at 0x%X", (unsigned)dmaOffsetArg);
 	if (!dmaStart)
 		die("failed to locate dmadata in rom");
 	
-	/* determine distal end of decompressed rom */
-	*dstSz = romSz;
+	/* iQue files are always headerless */
+	if (st->iQue)
+		st->headerlessFlag = 1;
+	
+	dmaNum = (beU32(dmaStart + STRIDE * IDX + 4) - (dmaStart - comp)) / STRIDE;
+	dmaEnd = dmaStart + dmaNum * STRIDE;
+
+	/* since we now know how many dma entries there are, we can allocate the list of
+	   compressed and uncompressed files for printing the z64compress args later. */
+	alloc_file_info(st, dmaNum);
+	
+	/* determine distal end of decompressed rom, which also has room for dmadata */
+	end = dmaEnd - comp;
 	for (dma = dmaStart; dma < dmaEnd; dma += STRIDE)
 	{
 		unsigned Vend = beU32(dma + 4);
-		if (Vend > *dstSz)
-			*dstSz *= 2;
+		if (dma_entry_valid(dma) && Vend > end)
+			end = Vend;
 	}
+	*dstSz = dec_size(end);
 	
 	/* iQue's default compression is zlib */
-	if (iQue && codecOverride == CODEC_NONE)
+	if (st->iQue && codecOverride == CODEC_NONE)
 		codecOverride = CODEC_ZLIB;
 	
 	/* allocate decompressed rom */
-	dec = calloc_safe(*dstSz, 1);
+	start = wow_time();
+	dec = alloc_dec(st, *dstSz);
+	st->stats.alloc += wow_time() - start;
 	
-	/* transfer files from comp to dec */
+	/* files are headerless, so what would be their header is just *
+	 * the 8 bytes before them                                     */
+	headerSkip = st->headerlessFlag ? 8 : 0;
+	
+	/* queue files for transfer from comp to dec */
+	job = arena_alloc(&st->arena, sizeof(*job) * (dmaNum + 1));
+	jobNum = 0;
 	for (dmaCur = 0, dma = dmaStart; dma < dmaEnd; dma += STRIDE, dmaCur++)
 	{
 		unsigned Vstart = beU32(dma +  0); /* virtual addresses */
 		unsigned Vend   = beU32(dma +  4);
 		unsigned Pstart = beU32(dma +  8); /* physical addresses */
 		unsigned Pend   = beU32(dma + 12);
+		DmaJob *j = job + jobNum;
 		
 		/* unused or invalid entry */
-		if (Pstart == DMA_DELETED
-			|| Vstart == DMA_DELETED
-			|| Pend == DMA_DELETED
-			|| Vend == DMA_DELETED
-			|| Vend <= Vstart /* sizes must be > 0 */
-			|| (Pend && Pend == Pstart)
-		)
+		if (!dma_entry_valid(dma))
 			continue;
 		
+		j->dst = dec + Vstart;
+		j->dstSz = Vend - Vstart;
+		j->headerSz = 0;
+		j->compressed = Pend != 0;
+		j->codec = CODEC_NONE;
+		j->entry = dmaCur;
+		
 		/* compressed */
 		if (Pend)
 		{
-			/* files are headerless */
-			if (headerlessFlag)
-				Pstart -= 8; 
-			
-			decompress(
-				dec + Vstart     /* dst */
-				, comp + Pstart  /* src */
-				, Pend - Pstart  /* sz  */
-				, codecOverride  /* codecOverride */
-			);
+			if (Pstart < headerSkip)
+				die("ERROR: dma entry %d starts before its header", dmaCur);
+			Pstart -= headerSkip;
+			if (Pend > romSz || Pend <= Pstart || Pend - Pstart < 4)
+				die("ERROR: dma entry %d is outside the rom", dmaCur);
+			j->src = comp + Pstart;
+			j->sz = Pend - Pstart;
 		}
 		else
 		{
 			/* not compressed */
-			memcpy(dec + Vstart, comp + Pstart, Vend - Vstart);
+			if (Pstart > romSz || j->dstSz > romSz - Pstart)
+				die("ERROR: dma entry %d is outside the rom", dmaCur);
+			j->src = comp + Pstart;
+			j->sz = Vend - Vstart;
 		}
+		jobNum++;
 
 		/* update the compressed info */
-		fileIsCompressed[dmaCur] = (Pend) ? 1 : 0;
+		st->fileIsCompressed[dmaCur] = (Pend) ? 1 : 0;
 
 		/* update dma entry */
 		wbeU32(dma +  8, Vstart);
 		wbeU32(dma + 12, 0);
 	}
+	
+	/* transfer files from comp to dec */
+	zero_gaps(st, dec, *dstSz, job, jobNum);
+	transfer_jobs(st, job, jobNum, codecOverride);
 
 	/* write the terminator */
-	fileIsCompressed[dmaCur] = -1;
+	st->fileIsCompressed[dmaCur] = -1;
 
 	/* copy modified dmadata to decompressed rom */
 	memcpy(dec + (dmaStart - comp), dmaStart, dmaNum * STRIDE);
 	
 	/* update crc */
+	start = wow_time();
 	n64crc(dec);
+	st->stats.crc += wow_time() - start;
+	
+	write_back(st, dmaStart - comp, dmaNum * STRIDE);
+	write_back(st, N64CRC_OFFSET, N64CRC_SIZE);
 
 	/* set the start of dmadata for the z64compress args */
-	dmaStartArg = dmaStart - comp;
+	st->dmaStartArg = dmaStart - comp;
 	
 	return dec;
 }
 
-static inline void *filedec(void *file, size_t fileSz, size_t *dstSz, Codec codecOverride) {
+static inline void *filedec(RomState *st, void *file, size_t fileSz, size_t *dstSz, Codec codecOverride) {
 	unsigned char *dec;
-
-	/* allocate file */
-	dec = calloc_safe(1024 * 1024 * 8, 1);
+	size_t decSz;
+	Codec codec;
+	double start;
+
+	/* allocate exactly as much as the header says the file needs */
+	decSz = z64dec_header_size(file, fileSz);
+	if (!decSz)
+		die("ERROR: compressed file header has no decompressed size");
+	start = wow_time();
+	dec = grow_buf(&st->decBuf, &st->decBufSz, decSz);
+	st->stats.alloc += wow_time() - start;
+	st->ctx.dst_max = decSz;
+	
+	start = wow_time();
 	
 	/* decompress */
 	*dstSz = decompress(
-		dec             /* dst */
+		&st->ctx        /* ctx */
+		, dec           /* dst */
 		, file          /* src */
 		, fileSz        /* sz  */
 		, codecOverride /* codecOverride */
+		, &codec        /* codecUsed */
 	);
+	st->ctx.dst_max = 0;
+	if (!*dstSz)
+		die("ERROR: failed to decompress file");
+	st->stats.transfer += wow_time() - start;
+	stats_file(&st->stats, -1, codec, fileSz, *dstSz, wow_time() - start);
 
 	return dec;
 }
 
+/* fwrite callback for streaming decoders */
+static int write_stdout(void *udata, const void *data, size_t sz)
+{
+	(void)udata;
+	
+	return fwrite(data, 1, sz, stdout) != sz;
+}
+
+/* decompress an individual file to stdout; Yaz0 files are streamed, *
+ * so they never need a buffer the size of the whole file            */
+static size_t filedec_stdout(RomState *st, void *file, size_t fileSz, Codec codecOverride)
+{
+	Codec codec = codecOverride;
+	size_t decSz;
+	
+#ifdef _WIN32
+	/* don't let windows turn \n into \r\n */
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	
+	if (codec == CODEC_NONE)
+		codec = get_codec_type_from_header(file);
+	
+	if (codec == CODEC_YAZ0)
+	{
+		double start = wow_time();
+		
+		/* writing is part of decoding when streaming */
+		decSz = yazdec_stream(&st->ctx, file, fileSz, write_stdout, NULL);
+		if (!decSz)
+			die("ERROR: failed to decompress file");
+		st->stats.transfer += wow_time() - start;
+		stats_file(&st->stats, -1, codec, fileSz, decSz, wow_time() - start);
+	}
+	else
+	{
+		void *dec = filedec(st, file, fileSz, &decSz, codecOverride);
+		double start = wow_time();
+		
+		write_stdout(NULL, dec, decSz);
+		st->stats.write += wow_time() - start;
+	}
+	
+	if (fflush(stdout) || ferror(stdout))
+		die("failed to write decompressed file to stdout");
+	
+	return decSz;
+}
+
 /* take "infile.z64" and make "infile.decompressed.z64" */
-static char *quickOutname(char *in)
+static char *quickOutname(const char *in)
 {
 	const char *append = ".decompressed.z64";
 	char *out;
@@ -468,6 +1053,7 @@ static void showargs(void)
 	P("Usage: z64decompress [file-in] [file-out] [options]");
 	P("  The [file-out] argument is optional if you do not use any options.");
 	P("  If not specified, \"file-in.decompressed.extension\" will be generated.");
+	P("  With -i, a [file-out] of - writes the decompressed file to stdout.");
 	P("");
 	P("Options:");
 	P("  -h, --help          show help information");
@@ -476,10 +1062,56 @@ static void showargs(void)
 	P("                      (not for use on roms)");
 	P("  -d, --dmaext        decompress rom using the ZZRTL dmaext hack");
 	P("  -k, --headerless    files don't have standard 8-byte header");
+	P("  -t, --threads       number of threads to decompress rom files with");
+	P("                      (0 = one per processor, default is 1)");
+	P("  -m, --mmap          map the input and output roms into memory");
+	P("                      instead of reading and writing them");
+	P("  -a, --align         round the decompressed rom size up to a");
+	P("                      multiple of this many bytes (a power of two;");
+	P("                      default is the next power of two)");
+	P("      --dma           rom offset of dmadata, rather than searching");
+	P("                      for it (e.g. --dma 0x7430)");
+	P("      --extract       decompress only these dma entries (e.g.");
+	P("                      --extract 3,5-8), writing each to");
+	P("                      \"file-out/N.bin\" rather than writing a rom");
+	P("                      (empty or deleted entries in a range are");
+	P("                      skipped)");
+	P("      --cache         reuse the files of a previous file-out that");
+	P("                      haven't changed since, as listed in");
+	P("                      \"file-out.cache\" (written alongside it)");
+	P("      --stats         report where the time went for each input");
+	P("      --stats-json    write the same report as one line of JSON");
+	P("                      per input to this file (- for stdout)");
+	P("      --verify        check that every file in every other argument");
+	P("                      (roms) decompresses to its size in dmadata");
+	P("                      without reading past its end, and that the");
+	P("                      crc is right, instead of writing anything");
+	P("      --bench         time each decoder over the compressed files");
+	P("                      in every other argument (roms, or files");
+	P("                      with -i) instead of writing anything");
+	P("      --reps          times --bench decompresses each file after");
+	P("                      warming up (default is 5)");
+	P("      --baseline      file --bench writes the throughput and a hash");
+	P("                      of the output of each codec to, or if it");
+	P("                      exists, fails if either got worse since");
+	P("      --tolerance     percentage a codec may be slower than its");
+	P("                      --baseline before it fails (default is 10)");
+	P("  -b, --batch         treat every other argument as an input, and");
+	P("                      write each to \"file-in.decompressed.z64\";");
+	P("                      directories add the files in them, and .txt");
+	P("                      files add the paths listed in them, one per");
+	P("                      line (with -t, inputs run in parallel)");
 	P("");
 	P("Example Usage:");
 	P("   z64decompress \"rom-in.z64\" \"rom-out.z64\"");
 	P("   z64decompress \"file-in.yaz\" \"file-out.bin\" -c yaz -i");
+	P("   z64decompress \"file-in.yaz\" - -i > \"file-out.bin\"");
+	P("   z64decompress \"rom-in.z64\" \"rom-out.z64\" --threads 0");
+	P("   z64decompress \"rom-in.z64\" \"files/\" --extract 28,1000");
+	P("   z64decompress --batch \"roms/\" \"more-roms.txt\" --threads 0");
+	P("   z64decompress --bench \"roms/\" --reps 10");
+	P("   z64decompress --bench \"roms/\" --baseline \"bench.txt\"");
+	P("   z64decompress --verify \"roms/\"");
 #ifdef _WIN32 /* helps users unfamiliar with command line */
 	P("");
 	P("Alternatively, Windows users can close this window and drop");
@@ -502,32 +1134,444 @@ static int toMiB(int compSz)
 }
 
 /* creates z64compress args once the rom successfully decompresses */
-static void printZ64CompressArgs(const char* decFileName, size_t compSz, Codec codec, unsigned dmaStart)
+static void printZ64CompressArgs(RomState *st, const char* decFileName, size_t compSz)
 {
 	int dmaEntries;
-	const char *headerless = headerlessFlag ? " --headerless" : "";
+	const char *headerless = st->headerlessFlag ? " --headerless" : "";
+	Codec codec = CODEC_YAZ0;
+	int codecFiles[CODEC_MAX] = { 0 };
+	int codecsUsed = 0;
+	char *args;
+	char *end;
+
+	/* count dma entries, and the files using each codec */
+	for (dmaEntries = 0; st->fileIsCompressed[dmaEntries] != -1; dmaEntries++)
+		if (st->fileCodec[dmaEntries] != CODEC_NONE)
+			codecFiles[(int)st->fileCodec[dmaEntries]]++;
+
+	/* z64compress takes one codec, so suggest the most used one */
+	for (int i = 0; i < CODEC_MAX; i++)
+	{
+		if (!codecFiles[i])
+			continue;
+		if (codecFiles[i] > codecFiles[codec])
+			codec = (Codec)i;
+		codecsUsed++;
+	}
+	if (codecsUsed > 1)
+	{
+		fprintf(stderr, "warning: '%s' uses more than one codec:", decFileName);
+		for (int i = 0; i < CODEC_MAX; i++)
+			if (codecFiles[i])
+				fprintf(stderr, " %s (%d files)", decCodecInfo[i].name, codecFiles[i]);
+		fprintf(stderr, "\n");
+	}
 
-	/* count dma entries */
-	for (dmaEntries = 0; fileIsCompressed[dmaEntries] != -1; dmaEntries++) {}
+	/* the args are printed in one go, so that roms *
+	 * decompressed in parallel don't mix them up   */
+	args = arena_alloc(&st->arena, 256 + strlen(decFileName) + dmaEntries * 24);
+	end = args;
 
 	/* print the normal z64compress args */
-	fprintf(stdout, "here are your z64compress arguments:\n");
-	fprintf(stdout, "z64compress --in \"%s\" --out \"out.z64\" --mb %d --codec %s --dma \"0x%X,%d\" --compress \"0-END\"%s",
+	end += sprintf(end, "here are your z64compress arguments:\n");
+	end += sprintf(end, "z64compress --in \"%s\" --out \"out.z64\" --mb %d --codec %s --dma \"0x%X,%d\" --compress \"0-END\"%s",
 		decFileName,               // use the decompressed file name
 		toMiB(compSz),             // convert the compressed size in bytes to megabytes
 		decCodecInfo[codec].name,  // use the codec name
-		dmaStart,                  // start of the dma table
+		st->dmaStartArg,           // start of the dma table
 		dmaEntries,                // number of dma entries
 		headerless                 // files are headerless when recompressing
 	);
 
 	/* print the file skips */
 	for (int i = 0; i < dmaEntries; i++) {
-		if (!fileIsCompressed[i]) {
-			fprintf(stdout, " --skip \"%d\"", i);
+		if (!st->fileIsCompressed[i]) {
+			end += sprintf(end, " --skip \"%d\"", i);
+		}
+	}
+	sprintf(end, "\n");
+	fputs(args, stdout);
+}
+
+/* prepare a RomState for its first input */
+static void rom_state_init(RomState *st, int threads)
+{
+	memset(st, 0, sizeof(*st));
+	st->numThreads = threads;
+
+	/* the whole file is always in memory, and only safe *
+	 * mode holds every decoder to dst_max               */
+	z64dec_ctx_init(&st->ctx, Z64DEC_FLAT | Z64DEC_SAFE);
+}
+
+/* free the buffers a RomState kept around */
+static void rom_state_free(RomState *st)
+{
+	free(st->decBuf);
+	free(st->compBuf);
+	arena_free(&st->arena);
+}
+
+/* decompress one rom or individual file to outfileName */
+static void decompress_input(RomState *st, const char *inFileName, const char *outfileName)
+{
+	/* decompressed file and size */
+	void *dec;
+	size_t decSz = 0;
+
+	/* for --stats */
+	double start;
+
+	/* compressed file and size */
+	void *comp;
+	size_t compSz;
+
+	/* flag that determines if this input is mapped rather than loaded */
+	int mapped = mmapFlag;
+
+	/* flag that determines if the output goes to stdout (file-out is "-") */
+	int toStdout = !strcmp(outfileName, "-");
+
+	/* forget everything about the previous input */
+	st->iQue = 0;
+	st->headerlessFlag = headerlessArg;
+	st->fileIsCompressed = NULL;
+	st->fileCodec = NULL;
+	st->dmaStartArg = 0;
+	st->decMapName = NULL;
+	st->decWriteName = NULL;
+	st->decWriter = NULL;
+	st->cacheName = NULL;
+	st->cache = NULL;
+	st->cacheEntry = NULL;
+	st->cacheEntryNum = 0;
+	st->loader = NULL;
+	stats_reset(&st->stats);
+	st->stats.threads = 1;
+
+	/* roms are written to stdout alongside the z64compress args */
+	if (toStdout && !individualFlag)
+		die("ERROR: only individual files can be written to stdout!");
+
+	/* mapping the output would truncate the input out from under us */
+	if (mapped && wow_same_file(inFileName, outfileName))
+		mapped = 0;
+
+	/* attempt to load file */
+	start = wow_time();
+	if (mapped)
+	{
+		comp = file_map(inFileName, &compSz);
+
+		/* an individual file's size isn't known until it's decompressed */
+		if (!individualFlag)
+			st->decMapName = outfileName;
+	}
+	else
+	{
+		compSz = file_size(inFileName);
+		if (!compSz)
+			die("failed to get size of file '%s'", inFileName);
+		comp = grow_buf(&st->compBuf, &st->compBufSz, compSz);
+		
+		/* a rom is decompressed while it's still being read, unless   *
+		 * every file is looked at first or the output replaces it     */
+		if (!individualFlag && !dmaExtFlag && !cacheFlag
+			&& !wow_same_file(inFileName, outfileName)
+		)
+			st->loader = file_loader_start(inFileName, &compSz, comp);
+		else
+			file_load_into(inFileName, &compSz, comp);
+
+		/* the input is in memory, so the output can start right away */
+		if (!individualFlag)
+			st->decWriteName = outfileName;
+	}
+	st->stats.load = wow_time() - start;
+
+	/* files are read back out of the previous output, so it can't *
+	 * be replaced until every file is done                        */
+	if (cacheFlag && !individualFlag && !wow_same_file(inFileName, outfileName))
+	{
+		st->cacheName = outfileName;
+		st->cache = dec_cache_load(outfileName);
+		st->decMapName = NULL;
+		st->decWriteName = NULL;
+	}
+
+	if (!individualFlag)
+	{
+		/* attempt to decompress rom */
+		if (dmaExtFlag)
+		{
+			dec = romdec_dmaext(st, comp, compSz, &decSz, codecType);
+		}
+		else
+		{
+			dec = romdec(st, comp, compSz, &decSz, codecType);
+		}
+		
+		/* the input may hold more than its files */
+		if (st->loader)
+		{
+			start = wow_time();
+			file_loader_finish(st->loader);
+			st->loader = NULL;
+			st->stats.load += wow_time() - start;
+		}
+
+		/* print arguments for z64compress */
+		printZ64CompressArgs(st, outfileName, compSz);
+	}
+	else
+	{
+		if (dmaExtFlag)
+		{
+			die("ERROR: dmaext can not be used with individual files!");
+		}
+		/* attempt to decompress individual file */
+		if (toStdout)
+		{
+			decSz = filedec_stdout(st, comp, compSz, codecType);
+			dec = NULL;
 		}
+		else
+			dec = filedec(st, comp, compSz, &decSz, codecType);
+	}
+
+	/* write out file (filedec_stdout has already written its own) */
+	start = wow_time();
+	if (st->decMapName)
+		file_unmap(dec, decSz);
+	else if (st->decWriter)
+		file_writer_close(st->decWriter);
+	else if (!toStdout)
+		file_write(outfileName, dec, decSz);
+	if (st->cacheName)
+		dec_cache_save(outfileName, st->cacheEntry, st->cacheEntryNum);
+	st->stats.write += wow_time() - start;
+
+	/* report where the time went */
+	if (statsFlag)
+		stats_print(&st->stats, inFileName, stderr, 0);
+	if (statsJson)
+		stats_print(&st->stats, inFileName, statsJson, 1);
+
+	fprintf(
+		stderr
+		, "decompressed %s '%s' written successfully\n"
+		, individualFlag ? "file" : "rom"
+		, toStdout ? "stdout" : outfileName
+	);
+
+	/* cleanup */
+	arena_reset(&st->arena);
+	if (mapped)
+		file_unmap(comp, compSz);
+}
+
+/* write the dmadata entries listed in spec (e.g. "3,5-8") from *
+ * a rom to outDir/N.bin, decompressing only those files         */
+static void extract_entries(const char *inFileName, const char *outDir, const char *spec)
+{
+	struct romview *view;
+	void *comp;
+	size_t compSz;
+	const char *s;
+	char *outName;
+	int written = 0;
+	
+	if (mmapFlag)
+		comp = file_map(inFileName, &compSz);
+	else
+		comp = file_load(inFileName, &compSz);
+	
+	view = romview_open(comp, compSz, dmaOffsetArg, codecType, headerlessArg);
+	if (!view && dmaOffsetArg >= 0)
+		die("ERROR: no dmadata at 0x%X", (unsigned)dmaOffsetArg);
+	if (!view)
+		die("failed to locate dmadata in rom");
+	
+	/* it's fine if the directory already exists */
+	if (!wow_is_dir(outDir) && wow_mkdir(outDir))
+		die("failed to create directory '%s'", outDir);
+	outName = malloc_safe(strlen(outDir) + 32);
+	
+	for (s = spec; *s; )
+	{
+		char *end;
+		long first = strtol(s, &end, 0);
+		long last = first;
+		
+		if (end == s || first < 0)
+			die("ERROR: invalid entry list: %s", spec);
+		if (*end == '-')
+		{
+			s = end + 1;
+			last = strtol(s, &end, 0);
+			if (end == s || last < first)
+				die("ERROR: invalid entry list: %s", spec);
+		}
+		if (*end && *end != ',')
+			die("ERROR: invalid entry list: %s", spec);
+		s = end + (*end == ',');
+		
+		for (long i = first; i <= last; ++i)
+		{
+			struct romview_entry e;
+			const void *dec;
+			size_t decSz;
+			
+			if (i >= romview_count(view))
+				die("ERROR: rom only has %d dma entries", romview_count(view));
+			
+			/* a range can take in entries that aren't files, *
+			 * but one asked for by itself has to be one      */
+			if (!romview_entry(view, i, &e))
+			{
+				if (first == last)
+					die("ERROR: dma entry %ld is empty or deleted", i);
+				fprintf(stderr, "warning: skipping dma entry %ld, which is empty or deleted\n", i);
+				continue;
+			}
+			
+			dec = romview_get(view, i, &decSz);
+			if (!dec)
+				die("ERROR: failed to decompress dma entry %ld", i);
+			
+			sprintf(outName, "%s/%ld.bin", outDir, i);
+			file_write(outName, (void *)dec, decSz);
+			written++;
+		}
+	}
+	
+	fprintf(stderr, "%d %s written to '%s'\n", written, written == 1 ? "file" : "files", outDir);
+	
+	/* cleanup */
+	free(outName);
+	romview_close(view);
+	if (mmapFlag)
+		file_unmap(comp, compSz);
+	else
+		free(comp);
+}
+
+/* inputs shared by every thread in batch mode */
+typedef struct {
+	char **name;
+	int num;
+	int next;         /* next index into name[] to be claimed */
+	int threadsPerInput;
+} BatchQueue;
+
+/* claim and decompress inputs until none are left */
+static void batch_worker(void *udata)
+{
+	BatchQueue *q = udata;
+	RomState st;
+	int i;
+
+	rom_state_init(&st, q->threadsPerInput);
+
+	while ((i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->num)
+	{
+		char *outfileName = quickOutname(q->name[i]);
+
+		decompress_input(&st, q->name[i], outfileName);
+		free(outfileName);
+	}
+
+	rom_state_free(&st);
+}
+
+/* decompress every input, several at once if numThreads allows it */
+static void batch_decompress(char **name, int num)
+{
+	BatchQueue q = { name, num, 0, 1 };
+	wow_thread *threads;
+	int threadNum = numThreads;
+	int i;
+
+	if (threadNum > num)
+		threadNum = num;
+
+	/* with fewer inputs than threads, each input gets several */
+	q.threadsPerInput = numThreads / threadNum;
+
+	/* this thread works alongside the others */
+	threads = malloc_safe(sizeof(*threads) * threadNum);
+	for (i = 1; i < threadNum; ++i)
+		if (wow_thread_create(&threads[i], batch_worker, &q))
+			die("ERROR: failed to create thread");
+	batch_worker(&q);
+	for (i = 1; i < threadNum; ++i)
+		wow_thread_join(threads[i]);
+
+	free(threads);
+}
+
+/* add an input to a batch; a directory adds every file in it     *
+ * that isn't a previous output, and a ".txt" file adds each path *
+ * listed in it, one per line                                     */
+static void batch_add(char ***list, int *num, const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	if (wow_is_dir(name))
+	{
+		char **files;
+		int filesNum;
+		int i;
+
+		files = wow_list_dir(name, &filesNum);
+		if (!files)
+			die("failed to open directory '%s'", name);
+
+		for (i = 0; i < filesNum; ++i)
+		{
+			if (!strstr(files[i], ".decompressed."))
+				batch_add(list, num, files[i]);
+			free(files[i]);
+		}
+		free(files);
+	}
+	else if (ext && !strcmp(ext, ".txt"))
+	{
+		char *text;
+		char *line;
+		char *next;
+		size_t textSz;
+
+		/* load the list as a string */
+		text = file_load(name, &textSz);
+		text = realloc_safe(text, textSz + 1);
+		text[textSz] = '\0';
+
+		/* not strtok, as listed .txt files recurse into here */
+		for (line = text; *line; line = next)
+		{
+			char *lineEnd = line + strcspn(line, "\r\n");
+
+			next = lineEnd + (*lineEnd != '\0');
+			*lineEnd = '\0';
+
+			/* ignore surrounding whitespace, blank lines, and comments */
+			while (*line == ' ' || *line == '\t')
+				++line;
+			while (lineEnd > line && (lineEnd[-1] == ' ' || lineEnd[-1] == '\t'))
+				*--lineEnd = '\0';
+			if (!*line || *line == '#')
+				continue;
+
+			batch_add(list, num, line);
+		}
+		free(text);
+	}
+	else
+	{
+		*list = realloc_safe(*list, sizeof(**list) * (*num + 1));
+		(*list)[(*num)++] = strdup_safe(name);
 	}
-	fprintf(stdout, "\n");
 }
 
 /**************************************
@@ -547,7 +1591,7 @@ static const char* get_arg_field(char** argv, const char* argName, const char* a
 	/* initialize i at 1 to skip program name */
 	for (int i = 1; argv[i] != NULL; i++)
 	{
-		if (!strcmp(argv[i], argName) || !strcmp(argv[i], altArgName))
+		if (!strcmp(argv[i], argName) || (altArgName && !strcmp(argv[i], altArgName)))
 		{
 			/* found the arg */
 			return argv[i + 1];
@@ -569,7 +1613,7 @@ static int get_arg_bool(char** argv, const char* argName, const char* altArgName
 	/* initialize i at 1 to skip program name */
 	for (int i = 1; argv[i] != NULL; i++)
 	{
-		if (!strcmp(argv[i], argName) || !strcmp(argv[i], altArgName))
+		if (!strcmp(argv[i], argName) || (altArgName && !strcmp(argv[i], altArgName)))
 		{
 			/* found the arg */
 			return 1;
@@ -578,6 +1622,23 @@ static int get_arg_bool(char** argv, const char* argName, const char* altArgName
 	return 0;
 }
 
+/* returns non-zero if an option is followed by a field */
+static int arg_has_field(const char *arg)
+{
+	static const char *withField[] = {
+		"--codec", "-c", "--threads", "-t", "--align", "-a", "--dma", "--extract", "--reps", "--baseline", "--tolerance", "--stats-json", NULL
+	};
+
+	for (int i = 0; withField[i]; i++)
+	{
+		if (!strcmp(arg, withField[i]))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
 wow_main
 {
 	/* input and output file names */
@@ -586,30 +1647,31 @@ wow_main
 	/* flag that determines if options are allowed (disabled when no output name is given) */
 	int optionsFlag;
 
-	/* flag that determines if individual files are decompressed or a whole rom */
-	int individualFlag = 0;
+	/* flag that determines if every non-option argument is an input */
+	int batchFlag;
 
-	/* flag that determines if dmaext hack is used */
-	int dmaExtFlag = 0;
+	/* flag that determines if decoders are timed rather than written out */
+	int benchFlag;
 
-	/* name of codec to use (for use with decCodecInfo.name) */
-	Codec codecType = CODEC_NONE;
+	/* flag that determines if roms are checked rather than written out */
+	int verifyFlag;
 
-	/* decompressed file and size */
-	void *dec;
-	size_t decSz;
+	/* number of times each file is decompressed by --bench */
+	int benchReps = 5;
+
+	/* file --bench records its results in, or checks them against */
+	const char *benchBaseline = NULL;
+
+	/* percentage a codec may be slower than its baseline */
+	double benchTolerance = 10;
 
-	/* compressed file and size */
-	void *comp;
-	size_t compSz;
-	
 	int exitCode = EXIT_SUCCESS;
 	wow_main_argv;
-	
+
 	/* Always expect the first and second arguments to be the input and output filenames */
 	#define ARG_INFILE  argv[1]
 	#define ARG_OUTFILE argv[2]
-	
+
 	/* welcome message */
 	fprintf(stderr, "welcome to z64decompress 1.0.3 <z64.me>\n");
 	fprintf(stderr, "extra features by @zel640\n");
@@ -620,10 +1682,19 @@ wow_main
 		showargs();
 		return EXIT_FAILURE;
 	}
-	
+
 	/* get the input and output files */
+	batchFlag = get_arg_bool(argv, "--batch", "-b");
+	benchFlag = get_arg_bool(argv, "--bench", NULL);
+	verifyFlag = get_arg_bool(argv, "--verify", NULL);
 	inFileName = ARG_INFILE;
-	if (argc <= 2) 
+	if (batchFlag || benchFlag || verifyFlag)
+	{
+		/* every input gets its own generated output name, if any */
+		optionsFlag = 1;
+		outfileName = NULL;
+	}
+	else if (argc <= 2)
 	{
 		/* user did not specify output file */
 		optionsFlag = 0;
@@ -640,11 +1711,20 @@ wow_main
 	if (optionsFlag)
 	{
 		const char *codecName;
+		const char *threadsArg;
+		const char *alignArg;
+		const char *dmaArg;
+		const char *repsArg;
+		const char *toleranceArg;
+		const char *statsJsonArg;
 
 		/* booleans */
 		individualFlag = get_arg_bool(argv, "--individual", "-i");
-		headerlessFlag = get_arg_bool(argv, "--headerless", "-k");
+		headerlessArg = get_arg_bool(argv, "--headerless", "-k");
 		dmaExtFlag = get_arg_bool(argv, "--dmaext", "-d");
+		mmapFlag = get_arg_bool(argv, "--mmap", "-m");
+		statsFlag = get_arg_bool(argv, "--stats", NULL);
+		cacheFlag = get_arg_bool(argv, "--cache", NULL);
 
 		/* fields */
 		codecName = get_arg_field(argv, "--codec", "-c");
@@ -658,58 +1738,184 @@ wow_main
 				die("ERROR: invalid codec name: %s\n", codecName);
 			}
 		}
+		
+		threadsArg = get_arg_field(argv, "--threads", "-t");
+		
+		if (threadsArg)
+		{
+			char *end;
+			
+			numThreads = strtol(threadsArg, &end, 10);
+			
+			if (*end || end == threadsArg || numThreads < 0)
+			{
+				die("ERROR: invalid thread count: %s\n", threadsArg);
+			}
+			
+			if (numThreads == 0)
+			{
+				numThreads = wow_cpu_count();
+			}
+		}
+		
+		dmaArg = get_arg_field(argv, "--dma", NULL);
+		
+		if (dmaArg)
+		{
+			char *end;
+			unsigned long offset = strtoul(dmaArg, &end, 0);
+			
+			if (*end || end == dmaArg || (offset & (STRIDE - 1)) || offset > 0x7FFFFFFF)
+			{
+				die("ERROR: invalid dmadata offset (must be a multiple of 16): %s\n", dmaArg);
+			}
+			
+			dmaOffsetArg = offset;
+		}
+		
+		extractArg = get_arg_field(argv, "--extract", NULL);
+		
+		if (extractArg && (individualFlag || dmaExtFlag || batchFlag || benchFlag || verifyFlag))
+		{
+			die("ERROR: --extract only works on standard roms\n");
+		}
+		
+		if (verifyFlag && (individualFlag || dmaExtFlag || batchFlag || benchFlag))
+		{
+			die("ERROR: --verify only works on standard roms\n");
+		}
+		
+		repsArg = get_arg_field(argv, "--reps", NULL);
+		
+		if (repsArg)
+		{
+			char *end;
+			
+			benchReps = strtol(repsArg, &end, 10);
+			
+			if (*end || end == repsArg || benchReps < 1)
+			{
+				die("ERROR: invalid repetition count: %s\n", repsArg);
+			}
+		}
+		
+		benchBaseline = get_arg_field(argv, "--baseline", NULL);
+		toleranceArg = get_arg_field(argv, "--tolerance", NULL);
+		
+		if ((benchBaseline || toleranceArg) && !benchFlag)
+		{
+			die("ERROR: --baseline and --tolerance only work with --bench\n");
+		}
+		
+		if (toleranceArg)
+		{
+			char *end;
+			
+			benchTolerance = strtod(toleranceArg, &end);
+			
+			if (*end || end == toleranceArg || benchTolerance < 0 || benchTolerance >= 100)
+			{
+				die("ERROR: invalid tolerance (a percentage below 100): %s\n", toleranceArg);
+			}
+		}
+		
+		statsJsonArg = get_arg_field(argv, "--stats-json", NULL);
+		
+		if (statsJsonArg)
+		{
+			if (!strcmp(statsJsonArg, "-"))
+				statsJson = stdout;
+			else if (!(statsJson = fopen(statsJsonArg, "w")))
+				die("ERROR: failed to open '%s' for writing\n", statsJsonArg);
+		}
+		
+		alignArg = get_arg_field(argv, "--align", "-a");
+		
+		if (alignArg)
+		{
+			char *end;
+			
+			romAlign = strtoul(alignArg, &end, 0);
+			
+			if (*end || end == alignArg || !romAlign || (romAlign & (romAlign - 1)))
+			{
+				die("ERROR: invalid alignment (must be a power of two): %s\n", alignArg);
+			}
+		}
 	}
 
-	/* attempt to load file */
-	comp = file_load(inFileName, &compSz);
-	
-	if (!individualFlag)
+	if (batchFlag || benchFlag || verifyFlag)
 	{
-		/* attempt to decompress rom */
-		if (dmaExtFlag)
+		char **input = NULL;
+		int inputNum = 0;
+
+		/* gather the inputs, skipping the options and their fields */
+		for (int i = 1; i < argc; i++)
 		{
-			dec = romdec_dmaext(comp, compSz, &decSz, codecType);
+			if (argv[i][0] == '-' && argv[i][1])
+			{
+				if (arg_has_field(argv[i]))
+					i++;
+				continue;
+			}
+			batch_add(&input, &inputNum, argv[i]);
 		}
-		else
+
+		if (!inputNum)
+			die("ERROR: no inputs given to %s", benchFlag ? "--bench" : verifyFlag ? "--verify" : "--batch");
+
+		if (benchFlag)
 		{
-			dec = romdec(comp, compSz, &decSz, codecType);
+			int bad = bench_run(input, inputNum, benchReps, codecType, headerlessArg, individualFlag, benchBaseline, benchTolerance);
+
+			if (bad)
+			{
+				fprintf(stderr, "%d %s regressed since '%s'\n", bad, bad == 1 ? "codec" : "codecs", benchBaseline);
+				exitCode = EXIT_FAILURE;
+			}
 		}
-		
-		/* print arguments for z64compress */
-		printZ64CompressArgs(outfileName, compSz, lastUsedCodec, dmaStartArg);
-	} 
-	else
-	{
-		if (dmaExtFlag)
+		else if (verifyFlag)
 		{
-			die("ERROR: dmaext can not be used with individual files!");
+			int bad = verify_run(input, inputNum, codecType, headerlessArg, dmaOffsetArg);
+
+			fprintf(stderr, "verified %d %s, %d failed\n", inputNum, inputNum == 1 ? "rom" : "roms", bad);
+			if (bad)
+				exitCode = EXIT_FAILURE;
 		}
-		/* attempt to decompress individual file */
-		dec = filedec(comp, compSz, &decSz, codecType);
-	}
+		else
+		{
+			batch_decompress(input, inputNum);
 
-	/* write out file */
-	file_write(outfileName, dec, decSz);
+			fprintf(stderr, "decompressed %d %s\n", inputNum, inputNum == 1 ? "input" : "inputs");
+		}
 
-	fprintf(
-		stderr
-		, "decompressed %s '%s' written successfully\n"
-		, individualFlag ? "file" : "rom"
-		, outfileName
-	);
+		for (int i = 0; i < inputNum; i++)
+			free(input[i]);
+		free(input);
+	}
+	else if (extractArg)
+	{
+		extract_entries(inFileName, outfileName, extractArg);
+	}
+	else
+	{
+		RomState st;
 
-	/* cleanup */
-	free(comp);
-	free(dec);
+		rom_state_init(&st, numThreads);
+		decompress_input(&st, inFileName, outfileName);
+		rom_state_free(&st);
+	}
+
+	if (statsJson && statsJson != stdout)
+		fclose(statsJson);
 
-	if (outfileName != ARG_OUTFILE)
+	if (outfileName && outfileName != ARG_OUTFILE)
 	{
 		free(outfileName);
 #ifdef _WIN32 /* assume user dropped file onto z64decompress.exe */
 		getchar();
 #endif
 	}
-	
+
 	return exitCode;
 }
-
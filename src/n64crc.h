@@ -25,8 +25,19 @@
 #ifndef N64CRC_H_INCLUDED
 #define N64CRC_H_INCLUDED
 
+/* bytes of the rom header n64crc() may change */
+#define N64CRC_OFFSET 0x10
+#define N64CRC_SIZE   8
+
+/* n64crc() reads this much of the rom */
+#define N64CRC_ROM_MIN 0x101000
+
 /* recalculate rom crc */
 void n64crc(void *rom);
 
+/* check a rom's crc without changing it; returns 0 if it's right, *
+ * 1 if it's wrong, or -1 if the rom's CIC isn't known             */
+int n64crc_check(const void *rom);
+
 #endif /* N64CRC_H_INCLUDED */
 
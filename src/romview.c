@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "romview.h"
+#include "wow.h"
+
+/* big-endian bytes to u32 */
+static inline unsigned beU32(const void *bytes)
+{
+	const unsigned char *b = bytes;
+	return ((unsigned)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* table always starts like so */
+static const unsigned char dmaStartMagic[] = {
+	0x00,0x00,0x00,0x00   /* Vstart */
+	, 0x00,0x00,0x10,0x60 /* Vend   */
+	, 0x00,0x00,0x00,0x00 /* Pstart */
+	, 0x00,0x00,0x00,0x00 /* Pend   */
+	, 0x00,0x00,0x10,0x60 /* Vstart (next) */
+};
+/* iQue has the hard-coded value x1050 instead of x1060 */
+static const unsigned char dmaStartiQue[] = {
+	0x00,0x00,0x00,0x00   /* Vstart */
+	, 0x00,0x00,0x10,0x50 /* Vend   */
+	, 0x00,0x00,0x00,0x00 /* Pstart */
+	, 0x00,0x00,0x00,0x00 /* Pend   */
+	, 0x00,0x00,0x10,0x50 /* Vstart (next) */
+};
+
+/* where retail builds keep dmadata, keyed on the game id in the *
+ * rom header; these are checked like any other candidate, so an *
+ * unlisted or modified rom only costs a few comparisons          */
+static const struct {
+	const char *id;   /* rom header bytes 0x3C-0x3D */
+	unsigned offset;
+} dmaHints[] = {
+	{ "ZL", 0x7430 },  /* ocarina ntsc 1.0 and 1.1 */
+	{ "ZL", 0x7960 },  /* ocarina ntsc 1.2 */
+	{ "ZL", 0x7950 },  /* ocarina pal */
+	{ "ZL", 0x7170 },  /* ocarina gamecube and master quest */
+	{ "ZL", 0x12F70 }, /* ocarina debug */
+	{ "ZS", 0x1A500 }, /* majora ntsc-u */
+};
+
+/* returns non-zero if rom has dmadata at offset, setting *
+ * *iQue according to which kind it is                    */
+static int is_dmadata(const unsigned char *rom, size_t romSz, size_t offset, int *iQue)
+{
+	const unsigned char *dma = rom + offset;
+	unsigned Vend;
+	
+	if (offset + STRIDE * (IDX + 1) > romSz)
+		return 0;
+	
+	/* data doesn't match */
+	Vend = beU32(dma + 4);
+	if (Vend == 0x1060)
+	{
+		if (memcmp(dma, dmaStartMagic, sizeof(dmaStartMagic)))
+			return 0;
+	}
+	else if (Vend == 0x1050)
+	{
+		if (memcmp(dma, dmaStartiQue, sizeof(dmaStartiQue)))
+			return 0;
+	}
+	else
+		return 0;
+	
+	/* table[IDX].Vstart isn't current rom offset */
+	if (beU32(dma + STRIDE * IDX) != offset)
+		return 0;
+	
+	/* table[IDX].Vend must be past it, and still inside the rom */
+	if (beU32(dma + STRIDE * IDX + 4) <= offset || beU32(dma + STRIDE * IDX + 4) > romSz)
+		return 0;
+	
+	/* all tests passed; this is dmadata */
+	*iQue = Vend == 0x1050;
+	return 1;
+}
+
+/* find dmadata in rom: at `offset` if it isn't -1, else at the     *
+ * usual place for the rom's game if it's there, else by searching *
+ * for it; sets *iQue according to the kind of table found, and    *
+ * returns NULL if there is none                                   */
+unsigned char *dma_find(const void *rom_, size_t romSz, long offset_, int *iQue)
+{
+	unsigned char *rom = (unsigned char *)rom_;
+	size_t offset;
+	size_t i;
+	
+	/* the caller knows where it is */
+	if (offset_ >= 0)
+		return is_dmadata(rom, romSz, offset_, iQue) ? rom + offset_ : NULL;
+	
+	/* try the retail offsets first */
+	for (i = 0; i < sizeof(dmaHints) / sizeof(*dmaHints) && romSz > 0x40; ++i)
+		if (!memcmp(rom + 0x3C, dmaHints[i].id, 2)
+			&& is_dmadata(rom, romSz, dmaHints[i].offset, iQue)
+		)
+			return rom + dmaHints[i].offset;
+	
+	/* the table always starts with Vend 0x1060 (0x1050 on iQue), so *
+	 * test that one word before comparing anything else             */
+	for (offset = 0; offset + 32 < romSz; offset += STRIDE)
+	{
+		unsigned Vend = beU32(rom + offset + 4);
+		
+		if ((Vend == 0x1060 || Vend == 0x1050) && is_dmadata(rom, romSz, offset, iQue))
+			return rom + offset;
+	}
+	
+	return NULL;
+}
+
+/* returns non-zero if a dmadata entry describes a file */
+int dma_entry_valid(const unsigned char *dma)
+{
+	unsigned Vstart = beU32(dma +  0); /* virtual addresses */
+	unsigned Vend   = beU32(dma +  4);
+	unsigned Pstart = beU32(dma +  8); /* physical addresses */
+	unsigned Pend   = beU32(dma + 12);
+	
+	/* unused or invalid entry */
+	if (Pstart == DMA_DELETED
+		|| Vstart == DMA_DELETED
+		|| Pend == DMA_DELETED
+		|| Vend == DMA_DELETED
+		|| Vend <= Vstart /* sizes must be > 0 */
+		|| (Pend && Pend == Pstart)
+	)
+		return 0;
+	
+	return 1;
+}
+
+struct romview
+{
+	const unsigned char *rom;
+	size_t romSz;
+	const unsigned char *dma;   /* dmadata within rom */
+	int dmaNum;
+	Codec codec;
+	int headerless;
+	struct z64dec_ctx ctx;
+	void **cache;               /* romview_get() results, by entry */
+};
+
+/* open a view of a rom in memory, which must stay valid and *
+ * unchanged until the view is closed; `dmaOffset` is as for *
+ * dma_find(), `codec` is CODEC_NONE to autodetect each file, *
+ * and `headerless` is non-zero if files have no 8-byte       *
+ * header (always the case on iQue); returns NULL if the rom  *
+ * has no dmadata                                             */
+struct romview *romview_open(const void *rom, size_t romSz, long dmaOffset, Codec codec, int headerless)
+{
+	struct romview *view;
+	unsigned char *dma;
+	int iQue;
+	
+	dma = dma_find(rom, romSz, dmaOffset, &iQue);
+	if (!dma)
+		return NULL;
+	
+	view = calloc_safe(1, sizeof(*view));
+	view->rom = rom;
+	view->romSz = romSz;
+	view->dma = dma;
+	view->dmaNum = (beU32(dma + STRIDE * IDX + 4) - (dma - view->rom)) / STRIDE;
+	view->codec = codec;
+	view->headerless = headerless;
+	view->cache = calloc_safe(view->dmaNum, sizeof(*view->cache));
+	
+	/* iQue files are headerless, and zlib by default */
+	if (iQue)
+	{
+		view->headerless = 1;
+		if (codec == CODEC_NONE)
+			view->codec = CODEC_ZLIB;
+	}
+	
+	/* the whole rom is in memory, and may be corrupt */
+	z64dec_ctx_init(&view->ctx, Z64DEC_FLAT | Z64DEC_SAFE);
+	
+	return view;
+}
+
+/* close a view, freeing every file it has cached */
+void romview_close(struct romview *view)
+{
+	int i;
+	
+	if (!view)
+		return;
+	
+	for (i = 0; i < view->dmaNum; ++i)
+		free(view->cache[i]);
+	free(view->cache);
+	free(view);
+}
+
+/* number of dmadata entries */
+int romview_count(const struct romview *view)
+{
+	return view->dmaNum;
+}
+
+/* entry `idx` as listed in dmadata; returns non-zero if the *
+ * entry describes a file (see dma_entry_valid)              */
+int romview_entry(const struct romview *view, int idx, struct romview_entry *entry)
+{
+	const unsigned char *dma;
+	
+	if (idx < 0 || idx >= view->dmaNum)
+		return 0;
+	
+	dma = view->dma + idx * STRIDE;
+	entry->Vstart = beU32(dma +  0);
+	entry->Vend   = beU32(dma +  4);
+	entry->Pstart = beU32(dma +  8);
+	entry->Pend   = beU32(dma + 12);
+	
+	return dma_entry_valid(dma);
+}
+
+/* codec file `idx` is decompressed with, or CODEC_NONE if it *
+ * isn't compressed or its codec is unknown                    */
+Codec romview_codec(const struct romview *view, int idx)
+{
+	struct romview_entry e;
+	
+	if (!romview_entry(view, idx, &e) || !e.Pend)
+		return CODEC_NONE;
+	
+	if (view->codec != CODEC_NONE)
+		return view->codec;
+	
+	/* files are headerless */
+	if (view->headerless)
+		e.Pstart -= 8;
+	
+	if (e.Pend > view->romSz || e.Pstart >= e.Pend || e.Pend - e.Pstart < 4)
+		return CODEC_NONE;
+	
+	return get_codec_type_from_header(view->rom + e.Pstart);
+}
+
+/* decompress file `idx` into dst, which must have room for its *
+ * Vend - Vstart bytes; returns that size, or 0 if the entry    *
+ * isn't a file, doesn't fit, or can't be decompressed          */
+size_t romview_read(struct romview *view, int idx, void *dst, size_t dstSz)
+{
+	struct romview_entry e;
+	unsigned char *src;
+	size_t sz;
+	size_t decSz;
+	Codec used;
+	
+	if (!romview_entry(view, idx, &e))
+		return 0;
+	
+	sz = e.Vend - e.Vstart;
+	if (dstSz < sz)
+		return 0;
+	
+	/* not compressed */
+	if (!e.Pend)
+	{
+		if (e.Pstart > view->romSz || sz > view->romSz - e.Pstart)
+			return 0;
+		memcpy(dst, view->rom + e.Pstart, sz);
+		return sz;
+	}
+	
+	/* files are headerless */
+	if (view->headerless)
+		e.Pstart -= 8;
+	
+	if (e.Pend > view->romSz || e.Pstart >= e.Pend)
+		return 0;
+	src = (unsigned char *)view->rom + e.Pstart;
+	
+	/* decompress() gives up on unknown codecs for good */
+	if (view->codec == CODEC_NONE && get_codec_type_from_header(src) == CODEC_NONE)
+		return 0;
+	
+	/* decompress no further than the room the caller gave; a *
+	 * corrupt file decodes to 0 bytes, which is no file at all  */
+	view->ctx.dst_max = dstSz;
+	decSz = decompress(&view->ctx, dst, src, e.Pend - e.Pstart, view->codec, &used);
+	view->ctx.dst_max = 0;
+	
+	if (decSz != sz)
+		return 0;
+	
+	return sz;
+}
+
+/* decompress files `first` to `last` (inclusive) into dst, laid *
+ * out as in the decompressed rom starting from the lowest Vstart *
+ * among them, with zeroes between; returns the size of that span *
+ * or 0 if a file can't be read or the span doesn't fit           */
+size_t romview_read_range(struct romview *view, int first, int last, void *dst, size_t dstSz)
+{
+	struct romview_entry e;
+	unsigned start = DMA_DELETED;
+	unsigned end = 0;
+	int i;
+	
+	/* find the span the files cover */
+	for (i = first; i <= last; ++i)
+	{
+		if (!romview_entry(view, i, &e))
+			continue;
+		if (e.Vstart < start)
+			start = e.Vstart;
+		if (e.Vend > end)
+			end = e.Vend;
+	}
+	if (start >= end || dstSz < end - start)
+		return 0;
+	
+	memset(dst, 0, end - start);
+	for (i = first; i <= last; ++i)
+	{
+		if (!romview_entry(view, i, &e))
+			continue;
+		if (!romview_read(view, i, (unsigned char *)dst + (e.Vstart - start), dstSz - (e.Vstart - start)))
+			return 0;
+	}
+	
+	return end - start;
+}
+
+/* describe a RomviewStatus */
+const char *romview_status_name(RomviewStatus status)
+{
+	switch (status)
+	{
+		case ROMVIEW_OK:
+			return "ok";
+		case ROMVIEW_OUTSIDE:
+			return "outside the rom";
+		case ROMVIEW_CODEC:
+			return "unknown encoding";
+		case ROMVIEW_HEADER:
+			return "header size mismatch";
+		case ROMVIEW_SIZE:
+			return "decompressed size mismatch";
+		case ROMVIEW_OVERREAD:
+			return "read past Pend";
+	}
+	
+	return "unknown";
+}
+
+/* check that file `idx` decompresses to exactly Vend - Vstart *
+ * bytes without reading past Pend, decompressing it into dst, *
+ * which must have room for Vend - Vstart bytes; files that    *
+ * aren't compressed need only lie within the rom              */
+RomviewStatus romview_check(struct romview *view, int idx, void *dst, size_t dstSz)
+{
+	struct romview_entry e;
+	unsigned char *src;
+	size_t srcSz;
+	size_t sz;
+	size_t decSz;
+	Codec codec;
+	
+	if (!romview_entry(view, idx, &e))
+		return ROMVIEW_OUTSIDE;
+	sz = e.Vend - e.Vstart;
+	
+	/* not compressed */
+	if (!e.Pend)
+	{
+		if (e.Pstart > view->romSz || sz > view->romSz - e.Pstart)
+			return ROMVIEW_OUTSIDE;
+		return ROMVIEW_OK;
+	}
+	
+	/* files are headerless */
+	if (view->headerless)
+	{
+		if (e.Pstart < 8)
+			return ROMVIEW_OUTSIDE;
+		e.Pstart -= 8;
+	}
+	
+	if (e.Pend > view->romSz || e.Pstart >= e.Pend)
+		return ROMVIEW_OUTSIDE;
+	src = (unsigned char *)view->rom + e.Pstart;
+	srcSz = e.Pend - e.Pstart;
+	
+	codec = romview_codec(view, idx);
+	if (codec == CODEC_NONE)
+		return ROMVIEW_CODEC;
+	
+	/* a header that's wrong would have the file overrun dst */
+	if (!view->headerless && z64dec_header_size(src, srcSz) != sz)
+		return ROMVIEW_HEADER;
+	if (dstSz < sz)
+		return ROMVIEW_SIZE;
+	
+	/* the decoder may read on to the end of the rom, so that a file *
+	 * that goes past Pend is told apart from one that won't decode  */
+	view->ctx.dst_max = dstSz;
+	view->ctx.src_end = NULL;
+	decSz = decCodecInfo[codec].decode(&view->ctx, src, dst, view->romSz - e.Pstart);
+	view->ctx.dst_max = 0;
+	
+	if (view->ctx.src_end && view->ctx.src_end > src + srcSz)
+		return ROMVIEW_OVERREAD;
+	if (decSz != sz)
+		return ROMVIEW_SIZE;
+	
+	return ROMVIEW_OK;
+}
+
+/* decompressed file `idx`, cached so later calls return it at *
+ * once; valid until the view is closed; returns NULL (and     *
+ * leaves *sz alone) if the file can't be read                 */
+const void *romview_get(struct romview *view, int idx, size_t *sz)
+{
+	struct romview_entry e;
+	size_t eSz;
+	
+	if (!romview_entry(view, idx, &e))
+		return NULL;
+	eSz = e.Vend - e.Vstart;
+	
+	if (!view->cache[idx])
+	{
+		void *dec = malloc_safe(eSz);
+		
+		if (!romview_read(view, idx, dec, eSz))
+		{
+			free(dec);
+			return NULL;
+		}
+		view->cache[idx] = dec;
+	}
+	
+	*sz = eSz;
+	return view->cache[idx];
+}
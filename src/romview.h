@@ -0,0 +1,92 @@
+#ifndef Z64DECOMPRESS_ROMVIEW_H_INCLUDED
+#define Z64DECOMPRESS_ROMVIEW_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "codec.h"
+
+#define STRIDE 16 /* bytes per dmadata entry */
+#define IDX    2  /* dmadata references itself at table[IDX] */
+#define DMA_DELETED 0xffffffff /* aka UINT32_MAX */
+
+/* find dmadata in rom: at `offset` if it isn't -1, else at the     *
+ * usual place for the rom's game if it's there, else by searching *
+ * for it; sets *iQue according to the kind of table found, and    *
+ * returns NULL if there is none                                   */
+unsigned char *dma_find(const void *rom, size_t romSz, long offset, int *iQue);
+
+/* returns non-zero if a dmadata entry describes a file */
+int dma_entry_valid(const unsigned char *dma);
+
+
+/* one file listed in dmadata */
+struct romview_entry
+{
+	unsigned Vstart;  /* virtual addresses */
+	unsigned Vend;
+	unsigned Pstart;  /* physical addresses */
+	unsigned Pend;    /* 0 if the file isn't compressed */
+};
+
+/* a compressed rom opened for reading individual files out of it; *
+ * a view is used by one thread at a time                          */
+struct romview;
+
+/* open a view of a rom in memory, which must stay valid and *
+ * unchanged until the view is closed; `dmaOffset` is as for *
+ * dma_find(), `codec` is CODEC_NONE to autodetect each file, *
+ * and `headerless` is non-zero if files have no 8-byte       *
+ * header (always the case on iQue); returns NULL if the rom  *
+ * has no dmadata                                             */
+struct romview *romview_open(const void *rom, size_t romSz, long dmaOffset, Codec codec, int headerless);
+
+/* close a view, freeing every file it has cached */
+void romview_close(struct romview *view);
+
+/* number of dmadata entries */
+int romview_count(const struct romview *view);
+
+/* entry `idx` as listed in dmadata; returns non-zero if the *
+ * entry describes a file (see dma_entry_valid)              */
+int romview_entry(const struct romview *view, int idx, struct romview_entry *entry);
+
+/* codec file `idx` is decompressed with, or CODEC_NONE if it *
+ * isn't compressed or its codec is unknown                    */
+Codec romview_codec(const struct romview *view, int idx);
+
+/* decompress file `idx` into dst, which must have room for its *
+ * Vend - Vstart bytes; returns that size, or 0 if the entry    *
+ * isn't a file, doesn't fit, or can't be decompressed          */
+size_t romview_read(struct romview *view, int idx, void *dst, size_t dstSz);
+
+/* decompress files `first` to `last` (inclusive) into dst, laid *
+ * out as in the decompressed rom starting from the lowest Vstart *
+ * among them, with zeroes between; returns the size of that span *
+ * or 0 if a file can't be read or the span doesn't fit           */
+size_t romview_read_range(struct romview *view, int first, int last, void *dst, size_t dstSz);
+
+/* outcome of romview_check() */
+typedef enum {
+	ROMVIEW_OK,
+	ROMVIEW_OUTSIDE,   /* the file lies outside the rom */
+	ROMVIEW_CODEC,     /* the file's codec is unknown */
+	ROMVIEW_HEADER,    /* its header gives a size other than Vend - Vstart */
+	ROMVIEW_SIZE,      /* it won't decompress, or not to Vend - Vstart bytes */
+	ROMVIEW_OVERREAD   /* decompressing it read past Pend */
+} RomviewStatus;
+
+/* describe a RomviewStatus */
+const char *romview_status_name(RomviewStatus status);
+
+/* check that file `idx` decompresses to exactly Vend - Vstart *
+ * bytes without reading past Pend, decompressing it into dst, *
+ * which must have room for Vend - Vstart bytes; files that    *
+ * aren't compressed need only lie within the rom              */
+RomviewStatus romview_check(struct romview *view, int idx, void *dst, size_t dstSz);
+
+/* decompressed file `idx`, cached so later calls return it at *
+ * once; valid until the view is closed; returns NULL (and     *
+ * leaves *sz alone) if the file can't be read                 */
+const void *romview_get(struct romview *view, int idx, size_t *sz);
+
+#endif /* Z64DECOMPRESS_ROMVIEW_H_INCLUDED */
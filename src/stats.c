@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "wow.h"
+
+#define MiB(X) ((X) / (1024.0 * 1024.0))
+#define MS(X)  ((X) * 1e3)
+
+/* forget everything recorded so far */
+void stats_reset(RomStats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+/* record one file transferred to the output; codec is CODEC_NONE *
+ * if it was copied as-is                                          */
+void stats_file(RomStats *stats, int entry, Codec codec, size_t in, size_t out, double time)
+{
+	struct stats_files *f = codec == CODEC_NONE ? &stats->copy : &stats->codec[codec];
+	struct stats_slow *slow = stats->slowest;
+	int i;
+
+	f->num++;
+	f->in += in;
+	f->out += out;
+	f->time += time;
+
+	/* insert among the slowest, if it's slower than one of them */
+	for (i = stats->slowestNum; i > 0 && slow[i - 1].time < time; --i)
+		if (i < STATS_SLOWEST)
+			slow[i] = slow[i - 1];
+	if (i >= STATS_SLOWEST)
+		return;
+	slow[i].entry = entry;
+	slow[i].codec = codec;
+	slow[i].out = out;
+	slow[i].time = time;
+	if (stats->slowestNum < STATS_SLOWEST)
+		stats->slowestNum++;
+}
+
+/* name of the codec a file used, for reports */
+static const char *codec_name(Codec codec)
+{
+	return codec == CODEC_NONE ? "copy" : decCodecInfo[codec].name;
+}
+
+/* append a json string to `end`, returning the new end */
+static char *json_string(char *end, const char *str)
+{
+	*end++ = '"';
+	for (; *str; ++str)
+	{
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+		{
+			*end++ = '\\';
+			*end++ = c;
+		}
+		else if (c < 0x20)
+			end += sprintf(end, "\\u%04x", c);
+		else
+			*end++ = c;
+	}
+	*end++ = '"';
+	*end = '\0';
+
+	return end;
+}
+
+/* print a report on one input to `out`, either for reading or as *
+ * a single line of JSON; the report is written in one go, so the *
+ * reports of inputs decompressed in parallel don't mix           */
+void stats_print(const RomStats *stats, const char *name, FILE *out, int json)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+	} phases[] = {
+		{ "load", offsetof(RomStats, load) },
+		{ "search", offsetof(RomStats, search) },
+		{ "alloc", offsetof(RomStats, alloc) },
+		{ "transfer", offsetof(RomStats, transfer) },
+		{ "crc", offsetof(RomStats, crc) },
+		{ "write", offsetof(RomStats, write) },
+	};
+	const int phaseNum = sizeof(phases) / sizeof(*phases);
+	double total = 0;
+	char *report;
+	char *end;
+	int i;
+
+	report = malloc_safe(4096 + strlen(name) * 6);
+	end = report;
+
+	for (i = 0; i < phaseNum; ++i)
+		total += *(const double *)((const char *)stats + phases[i].offset);
+
+	if (json)
+	{
+		const char *sep = "";
+
+		end += sprintf(end, "{\"input\":");
+		end = json_string(end, name);
+		end += sprintf(end, ",\"threads\":%d,\"phases\":{", stats->threads);
+		for (i = 0; i < phaseNum; ++i)
+			end += sprintf(end, "\"%s\":%.6f,", phases[i].name
+				, *(const double *)((const char *)stats + phases[i].offset)
+			);
+		end += sprintf(end, "\"total\":%.6f},\"codecs\":{", total);
+		for (i = 0; i < CODEC_MAX; ++i)
+		{
+			const struct stats_files *f = &stats->codec[i];
+
+			if (!f->num)
+				continue;
+			end += sprintf(end, "%s\"%s\":{\"files\":%d,\"in\":%zu,\"out\":%zu,\"time\":%.6f}"
+				, sep, decCodecInfo[i].name, f->num, f->in, f->out, f->time
+			);
+			sep = ",";
+		}
+		end += sprintf(end, "},\"copy\":{\"files\":%d,\"bytes\":%zu,\"time\":%.6f}"
+			, stats->copy.num, stats->copy.out, stats->copy.time
+		);
+		end += sprintf(end, ",\"cached\":{\"files\":%d,\"in\":%zu,\"out\":%zu},\"slowest\":["
+			, stats->cached.num, stats->cached.in, stats->cached.out
+		);
+		for (i = 0; i < stats->slowestNum; ++i)
+		{
+			const struct stats_slow *s = &stats->slowest[i];
+
+			end += sprintf(end, "%s{\"entry\":%d,\"codec\":\"%s\",\"out\":%zu,\"time\":%.6f}"
+				, i ? "," : "", s->entry, codec_name(s->codec), s->out, s->time
+			);
+		}
+		sprintf(end, "]}\n");
+	}
+	else
+	{
+		end += sprintf(end, "stats for '%s' (%d %s):\n", name
+			, stats->threads, stats->threads == 1 ? "thread" : "threads"
+		);
+		for (i = 0; i < phaseNum; ++i)
+			end += sprintf(end, "  %-10s %10.3f ms\n", phases[i].name
+				, MS(*(const double *)((const char *)stats + phases[i].offset))
+			);
+		end += sprintf(end, "  %-10s %10.3f ms\n", "total", MS(total));
+		for (i = 0; i < CODEC_MAX; ++i)
+		{
+			const struct stats_files *f = &stats->codec[i];
+
+			if (!f->num)
+				continue;
+			end += sprintf(end, "  %-5s %5d files %9.2f MiB -> %9.2f MiB %10.3f ms %9.1f MB/s\n"
+				, decCodecInfo[i].name, f->num, MiB(f->in), MiB(f->out), MS(f->time)
+				, f->time > 0 ? f->out / f->time / 1e6 : 0
+			);
+		}
+		if (stats->copy.num)
+			end += sprintf(end, "  %-5s %5d files %9.2f MiB copied %13.3f ms\n"
+				, "copy", stats->copy.num, MiB(stats->copy.out), MS(stats->copy.time)
+			);
+		if (stats->cached.num)
+			end += sprintf(end, "  %-5s %5d files %9.2f MiB -> %9.2f MiB reused\n"
+				, "cache", stats->cached.num, MiB(stats->cached.in), MiB(stats->cached.out)
+			);
+		for (i = 0; i < stats->slowestNum && stats->slowest[0].entry >= 0; ++i)
+		{
+			const struct stats_slow *s = &stats->slowest[i];
+
+			if (!i)
+				end += sprintf(end, "  slowest files:\n");
+			end += sprintf(end, "    entry %5d %-5s %9.2f MiB %10.3f ms\n"
+				, s->entry, codec_name(s->codec), MiB(s->out), MS(s->time)
+			);
+		}
+	}
+
+	fputs(report, out);
+	free(report);
+}
@@ -0,0 +1,53 @@
+#ifndef Z64DECOMPRESS_STATS_H_INCLUDED
+#define Z64DECOMPRESS_STATS_H_INCLUDED
+
+#include <stdio.h> /* FILE */
+
+#include "codec.h"
+
+#define STATS_SLOWEST 8 /* number of slowest files kept */
+
+/* where the time went while decompressing one input, for --stats; *
+ * times are in seconds                                            */
+typedef struct {
+	/* phases, as wall-clock time */
+	double load;       /* reading (or mapping) the input */
+	double search;     /* finding dmadata */
+	double alloc;      /* allocating (or mapping) the output */
+	double transfer;   /* every file, however many threads it took */
+	double crc;        /* updating the rom's checksum */
+	double write;      /* writing (or unmapping) the output */
+
+	/* files, as time summed over every thread */
+	struct stats_files {
+		int num;
+		size_t in;      /* compressed bytes read */
+		size_t out;     /* bytes written to the output */
+		double time;
+	} codec[CODEC_MAX], copy, cached; /* cached: read back by --cache */
+
+	/* slowest files, slowest first */
+	struct stats_slow {
+		int entry;      /* dma entry, or -1 for an individual file */
+		Codec codec;    /* CODEC_NONE if copied as-is */
+		size_t out;
+		double time;
+	} slowest[STATS_SLOWEST];
+	int slowestNum;
+
+	int threads;
+} RomStats;
+
+/* forget everything recorded so far */
+void stats_reset(RomStats *stats);
+
+/* record one file transferred to the output; codec is CODEC_NONE *
+ * if it was copied as-is                                          */
+void stats_file(RomStats *stats, int entry, Codec codec, size_t in, size_t out, double time);
+
+/* print a report on one input to `out`, either for reading or as *
+ * a single line of JSON; the report is written in one go, so the *
+ * reports of inputs decompressed in parallel don't mix           */
+void stats_print(const RomStats *stats, const char *name, FILE *out, int json);
+
+#endif /* Z64DECOMPRESS_STATS_H_INCLUDED */
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "verify.h"
+#include "romview.h"
+#include "n64crc.h"
+#include "file.h"
+#include "wow.h"
+
+/* a report, built up a line at a time */
+struct report
+{
+	char   *text;
+	size_t  len;
+	size_t  cap;
+};
+
+/* append a line to a report, growing it to fit */
+static void report_add(struct report *r, const char *fmt, ...)
+{
+	va_list args;
+	int n;
+	
+	va_start(args, fmt);
+	n = vsnprintf(r->text + r->len, r->cap - r->len, fmt, args);
+	va_end(args);
+	if (n < 0)
+		die("failed to format report");
+	
+	/* it didn't fit, so try again with room for it */
+	if ((size_t)n >= r->cap - r->len)
+	{
+		while ((size_t)n >= r->cap - r->len)
+			r->cap *= 2;
+		r->text = realloc_safe(r->text, r->cap);
+		va_start(args, fmt);
+		vsnprintf(r->text + r->len, r->cap - r->len, fmt, args);
+		va_end(args);
+	}
+	r->len += n;
+}
+
+int verify_rom(const char *name, const void *rom, size_t romSz, void **scratch, size_t *scratchSz, Codec codec, int headerless, long dmaOffset, FILE *out)
+{
+	struct romview *view;
+	struct report report;
+	unsigned char *crcBuf;
+	size_t maxSz = 0;
+	int files = 0;
+	int failed = 0;
+	int crc;
+	int i;
+	
+	view = romview_open(rom, romSz, dmaOffset, codec, headerless);
+	if (!view)
+	{
+		fprintf(out, "'%s': FAIL, no dmadata\n", name);
+		return 1;
+	}
+	
+	/* every file is decompressed into the same buffer, *
+	 * which only has to fit the biggest                */
+	for (i = 0; i < romview_count(view); ++i)
+	{
+		struct romview_entry e;
+		
+		if (romview_entry(view, i, &e) && e.Vend - e.Vstart > maxSz)
+			maxSz = e.Vend - e.Vstart;
+	}
+	if (*scratchSz < maxSz)
+	{
+		free(*scratch);
+		*scratch = malloc_safe(maxSz);
+		*scratchSz = maxSz;
+	}
+	
+	/* most lines are under 64 bytes, so that's a start */
+	report.len = 0;
+	report.cap = 256 + strlen(name) + romview_count(view) * 64;
+	report.text = malloc_safe(report.cap);
+	for (i = 0; i < romview_count(view); ++i)
+	{
+		struct romview_entry e;
+		RomviewStatus status;
+		Codec c;
+		
+		if (!romview_entry(view, i, &e))
+			continue;
+		
+		status = romview_check(view, i, *scratch, *scratchSz);
+		c = romview_codec(view, i);
+		files++;
+		failed += status != ROMVIEW_OK;
+		
+		report_add(&report, "%5d %-5s %08X %08X %s%s\n", i
+			, e.Pend ? (c == CODEC_NONE ? "?" : decCodecInfo[c].name) : "copy"
+			, e.Vstart, e.Vend
+			, status == ROMVIEW_OK ? "" : "FAIL, "
+			, romview_status_name(status)
+		);
+	}
+	
+	/* the crc is of the rom as it is, and covers only its start */
+	if (romSz >= N64CRC_ROM_MIN)
+		crc = n64crc_check(rom);
+	else
+	{
+		crcBuf = calloc_safe(1, N64CRC_ROM_MIN);
+		memcpy(crcBuf, rom, romSz);
+		crc = n64crc_check(crcBuf);
+		free(crcBuf);
+	}
+	
+	report_add(&report, "'%s': %s, %d %s, %d failed, crc %s\n", name
+		, failed || crc > 0 ? "FAIL" : "ok"
+		, files, files == 1 ? "file" : "files", failed
+		, crc < 0 ? "unknown (unrecognised CIC)" : crc ? "wrong" : "ok"
+	);
+	fputs(report.text, out);
+	
+	/* cleanup */
+	free(report.text);
+	romview_close(view);
+	
+	return failed + (crc > 0);
+}
+
+/* check that every file in a list of roms decompresses as dmadata *
+ * says it should, and that each rom's crc is right, without        *
+ * building the decompressed roms; prints a line for each file and  *
+ * a summary for each rom to stdout, and returns the number of roms *
+ * with a problem; `codec`, `headerless` and `dmaOffset` are as for *
+ * romview_open()                                                   */
+int verify_run(char **input, int num, Codec codec, int headerless, long dmaOffset)
+{
+	void *scratch = NULL;
+	size_t scratchSz = 0;
+	int bad = 0;
+	int i;
+	
+	for (i = 0; i < num; ++i)
+	{
+		size_t romSz;
+		void *rom = file_map(input[i], &romSz);
+		
+		bad += verify_rom(input[i], rom, romSz, &scratch, &scratchSz, codec, headerless, dmaOffset, stdout) != 0;
+		file_unmap(rom, romSz);
+	}
+	
+	free(scratch);
+	
+	return bad;
+}
@@ -0,0 +1,23 @@
+#ifndef Z64DECOMPRESS_VERIFY_H_INCLUDED
+#define Z64DECOMPRESS_VERIFY_H_INCLUDED
+
+#include <stdio.h>
+
+#include "codec.h"
+
+/* check one rom already in memory, as verify_run() does, writing *
+ * its report to `out`; *scratch is a buffer of *scratchSz bytes  *
+ * that files are decompressed into, grown as needed and reused   *
+ * from one rom to the next (start with NULL and 0, and free it   *
+ * when done); returns the number of problems found               */
+int verify_rom(const char *name, const void *rom, size_t romSz, void **scratch, size_t *scratchSz, Codec codec, int headerless, long dmaOffset, FILE *out);
+
+/* check that every file in a list of roms decompresses as dmadata *
+ * says it should, and that each rom's crc is right, without        *
+ * building the decompressed roms; prints a line for each file and  *
+ * a summary for each rom to stdout, and returns the number of roms *
+ * with a problem; `codec`, `headerless` and `dmaOffset` are as for *
+ * romview_open()                                                   */
+int verify_run(char **input, int num, Codec codec, int headerless, long dmaOffset);
+
+#endif /* Z64DECOMPRESS_VERIFY_H_INCLUDED */
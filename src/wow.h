@@ -22,8 +22,16 @@
 
 #ifdef _WIN32
  #include <windows.h>
+ #include <psapi.h> /* GetProcessMemoryInfo */
  #undef near
  #undef far
+#else
+ #include <pthread.h>
+ #include <fcntl.h> /* open */
+ #include <sys/mman.h> /* mmap */
+ #include <dirent.h> /* opendir */
+ #include <time.h> /* clock_gettime */
+ #include <sys/resource.h> /* getrusage */
 #endif
 
 
@@ -145,6 +153,130 @@ WOW_API_PREFIX void *realloc_safe(void *ptr, size_t size);
 WOW_API_PREFIX char *strdup_safe(const char *s);
 WOW_API_PREFIX void *memdup_safe(void *ptr, size_t size);
 
+
+/* thread handle */
+#ifdef _WIN32
+typedef HANDLE wow_thread;
+#else
+typedef pthread_t wow_thread;
+#endif
+
+/* start a thread that runs func(udata); returns non-zero on failure */
+WOW_API_PREFIX
+int
+wow_thread_create(wow_thread *thread, void (*func)(void *udata), void *udata);
+
+
+/* wait for a thread to finish */
+WOW_API_PREFIX
+void
+wow_thread_join(wow_thread thread);
+
+
+/* mutex, and condition variable to wait on while holding one */
+#ifdef _WIN32
+typedef CRITICAL_SECTION wow_mutex;
+typedef CONDITION_VARIABLE wow_cond;
+#else
+typedef pthread_mutex_t wow_mutex;
+typedef pthread_cond_t wow_cond;
+#endif
+
+WOW_API_PREFIX void wow_mutex_init(wow_mutex *mutex);
+WOW_API_PREFIX void wow_mutex_destroy(wow_mutex *mutex);
+WOW_API_PREFIX void wow_mutex_lock(wow_mutex *mutex);
+WOW_API_PREFIX void wow_mutex_unlock(wow_mutex *mutex);
+WOW_API_PREFIX void wow_cond_init(wow_cond *cond);
+WOW_API_PREFIX void wow_cond_destroy(wow_cond *cond);
+
+/* release the mutex, wait to be woken, and take it back */
+WOW_API_PREFIX void wow_cond_wait(wow_cond *cond, wow_mutex *mutex);
+
+/* wake every thread waiting on a condition variable */
+WOW_API_PREFIX void wow_cond_broadcast(wow_cond *cond);
+
+
+/* number of logical processors available (always at least 1) */
+WOW_API_PREFIX
+int
+wow_cpu_count(void);
+
+
+/* seconds elapsed since some fixed point, for timing things */
+WOW_API_PREFIX
+double
+wow_time(void);
+
+
+/* most memory the process has had resident at once, in bytes */
+WOW_API_PREFIX
+size_t
+wow_peak_rss(void);
+
+
+/* map a whole file into memory; the mapping is writable, but the *
+ * writes are private to the process and never reach the file;    *
+ * returns 0 on failure                                           */
+WOW_API_PREFIX
+void *
+wow_map_file(char const *name, size_t *sz);
+
+
+/* create (or truncate) a zero-filled file of `sz` bytes and map *
+ * it into memory for writing; returns 0 on failure              */
+WOW_API_PREFIX
+void *
+wow_map_new_file(char const *name, size_t sz);
+
+
+/* unmap a file mapped by wow_map_file or wow_map_new_file */
+WOW_API_PREFIX
+void
+wow_unmap_file(void *data, size_t sz);
+
+
+/* file handle for positioned writes */
+#ifdef _WIN32
+typedef HANDLE wow_fd;
+#else
+typedef int wow_fd;
+#endif
+
+/* create (or truncate) a file of `sz` bytes for writing at any  *
+ * offset, from any thread; the parts never written read as      *
+ * zeroes and take up no space where the file system supports    *
+ * sparse files; returns non-zero on failure                     */
+WOW_API_PREFIX
+int
+wow_open_sparse(char const *name, size_t sz, wow_fd *fd);
+
+
+/* write `sz` bytes to a file at `offset`; returns non-zero on failure */
+WOW_API_PREFIX
+int
+wow_pwrite(wow_fd fd, void const *data, size_t sz, size_t offset);
+
+
+/* close a file opened by wow_open_sparse; returns non-zero on failure */
+WOW_API_PREFIX
+int
+wow_close_fd(wow_fd fd);
+
+
+/* returns non-zero if both paths refer to the same existing file */
+WOW_API_PREFIX
+int
+wow_same_file(char const *a, char const *b);
+
+
+/* list the regular files in a directory, sorted by name; returns *
+ * an array of `*num` paths ("dir/name") and a null terminator,   *
+ * or 0 if the directory can't be opened; free each path and the  *
+ * array when done with them                                      */
+WOW_API_PREFIX
+char **
+wow_list_dir(char const *path, int *num);
+
 #ifdef WOW_IMPLEMENTATION
 
 WOW_API_PREFIX void die(const char *fmt, ...)
@@ -763,6 +895,591 @@ wow_system_gui(char const *name, const char *param)
 #endif
 }
 
+/* thread entry point and argument, repackaged for the native api */
+struct wow_thread_start
+{
+	void (*func)(void *udata);
+	void *udata;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI wow_thread_trampoline(LPVOID arg)
+#else
+static void *wow_thread_trampoline(void *arg)
+#endif
+{
+	struct wow_thread_start start = *(struct wow_thread_start*)arg;
+	
+	free(arg);
+	start.func(start.udata);
+	
+	return 0;
+}
+
+
+/* start a thread that runs func(udata); returns non-zero on failure */
+WOW_API_PREFIX
+int
+wow_thread_create(wow_thread *thread, void (*func)(void *udata), void *udata)
+{
+	struct wow_thread_start *start = malloc_safe(sizeof(*start));
+	
+	start->func = func;
+	start->udata = udata;
+	
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, wow_thread_trampoline, start, 0, NULL);
+	if (*thread)
+		return 0;
+#else
+	if (!pthread_create(thread, NULL, wow_thread_trampoline, start))
+		return 0;
+#endif
+	free(start);
+	return -1;
+}
+
+
+/* wait for a thread to finish */
+WOW_API_PREFIX
+void
+wow_thread_join(wow_thread thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+
+/* mutex, and condition variable to wait on while holding one */
+WOW_API_PREFIX
+void
+wow_mutex_init(wow_mutex *mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+WOW_API_PREFIX
+void
+wow_mutex_destroy(wow_mutex *mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(mutex);
+#else
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+WOW_API_PREFIX
+void
+wow_mutex_lock(wow_mutex *mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+WOW_API_PREFIX
+void
+wow_mutex_unlock(wow_mutex *mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+WOW_API_PREFIX
+void
+wow_cond_init(wow_cond *cond)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(cond);
+#else
+	pthread_cond_init(cond, NULL);
+#endif
+}
+
+WOW_API_PREFIX
+void
+wow_cond_destroy(wow_cond *cond)
+{
+#ifdef _WIN32
+	(void)cond; /* nothing to free */
+#else
+	pthread_cond_destroy(cond);
+#endif
+}
+
+/* release the mutex, wait to be woken, and take it back */
+WOW_API_PREFIX
+void
+wow_cond_wait(wow_cond *cond, wow_mutex *mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+	pthread_cond_wait(cond, mutex);
+#endif
+}
+
+/* wake every thread waiting on a condition variable */
+WOW_API_PREFIX
+void
+wow_cond_broadcast(wow_cond *cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(cond);
+#else
+	pthread_cond_broadcast(cond);
+#endif
+}
+
+
+/* number of logical processors available (always at least 1) */
+WOW_API_PREFIX
+int
+wow_cpu_count(void)
+{
+	long n;
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	n = info.dwNumberOfProcessors;
+#else
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n < 1 ? 1 : n;
+}
+
+/* seconds elapsed since some fixed point, for timing things */
+WOW_API_PREFIX
+double
+wow_time(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* most memory the process has had resident at once, in bytes */
+WOW_API_PREFIX
+size_t
+wow_peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+ #ifdef __APPLE__
+	return ru.ru_maxrss; /* already in bytes */
+ #else
+	return (size_t)ru.ru_maxrss * 1024;
+ #endif
+#endif
+}
+
+#ifdef _WIN32
+/* CreateFile abstraction for utf8 support on windows win32 */
+static HANDLE wow_create_file(char const *name, DWORD access, DWORD creation, DWORD flags)
+{
+	HANDLE h;
+#ifdef UNICODE
+	void *wname = wow_utf8_to_wchar(name);
+	
+	h = CreateFileW(wname, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, creation, flags, NULL);
+	free(wname);
+#else
+	h = CreateFileA(name, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, creation, flags, NULL);
+#endif
+	return h;
+}
+#endif
+
+
+/* map a whole file into memory; the mapping is writable, but the *
+ * writes are private to the process and never reach the file;    *
+ * returns 0 on failure                                           */
+WOW_API_PREFIX
+void *
+wow_map_file(char const *name, size_t *sz)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	HANDLE h;
+	HANDLE m;
+	void *data = 0;
+	
+	h = wow_create_file(name, GENERIC_READ, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL);
+	if (h == INVALID_HANDLE_VALUE)
+		return 0;
+	
+	if (GetFileSizeEx(h, &size) && size.QuadPart > 0
+		&& (unsigned long long)size.QuadPart <= (size_t)-1
+		&& (m = CreateFileMapping(h, NULL, PAGE_WRITECOPY, 0, 0, NULL))
+	)
+	{
+		/* the view keeps the file open */
+		data = MapViewOfFile(m, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(m);
+	}
+	CloseHandle(h);
+	
+	if (data)
+		*sz = size.QuadPart;
+	return data;
+#else
+	struct stat s;
+	void *data;
+	int fd;
+	
+	if ((fd = open(name, O_RDONLY)) < 0)
+		return 0;
+	
+	if (fstat(fd, &s) || !S_ISREG(s.st_mode) || s.st_size <= 0)
+	{
+		close(fd);
+		return 0;
+	}
+	
+	/* the mapping keeps the file open */
+	data = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if (data == MAP_FAILED)
+		return 0;
+	
+	*sz = s.st_size;
+	return data;
+#endif
+}
+
+
+/* create (or truncate) a zero-filled file of `sz` bytes and map *
+ * it into memory for writing; returns 0 on failure              */
+WOW_API_PREFIX
+void *
+wow_map_new_file(char const *name, size_t sz)
+{
+#ifdef _WIN32
+	unsigned long long size = sz;
+	HANDLE h;
+	HANDLE m;
+	void *data = 0;
+	
+	h = wow_create_file(name, GENERIC_READ | GENERIC_WRITE, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL);
+	if (h == INVALID_HANDLE_VALUE)
+		return 0;
+	
+	/* creating the mapping extends the file to `sz` bytes */
+	m = CreateFileMapping(h, NULL, PAGE_READWRITE, size >> 32, size & 0xffffffff, NULL);
+	if (m)
+	{
+		data = MapViewOfFile(m, FILE_MAP_WRITE, 0, 0, sz);
+		CloseHandle(m);
+	}
+	CloseHandle(h);
+	
+	return data;
+#else
+	void *data;
+	int fd;
+	
+	if ((fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+		return 0;
+	
+	if (ftruncate(fd, sz))
+	{
+		close(fd);
+		return 0;
+	}
+	
+	data = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	
+	if (data == MAP_FAILED)
+		return 0;
+	
+	return data;
+#endif
+}
+
+
+/* unmap a file mapped by wow_map_file or wow_map_new_file */
+WOW_API_PREFIX
+void
+wow_unmap_file(void *data, size_t sz)
+{
+#ifdef _WIN32
+	(void)sz; /* unused parameter */
+	UnmapViewOfFile(data);
+#else
+	munmap(data, sz);
+#endif
+}
+
+
+/* create (or truncate) a file of `sz` bytes for writing at any  *
+ * offset, from any thread; the parts never written read as      *
+ * zeroes and take up no space where the file system supports    *
+ * sparse files; returns non-zero on failure                     */
+WOW_API_PREFIX
+int
+wow_open_sparse(char const *name, size_t sz, wow_fd *fd)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	DWORD unused;
+	HANDLE h;
+	
+	h = wow_create_file(name, GENERIC_WRITE, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL);
+	if (h == INVALID_HANDLE_VALUE)
+		return -1;
+	
+	/* not every file system can do this, which is fine */
+	DeviceIoControl(h, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &unused, NULL);
+	
+	size.QuadPart = sz;
+	if (!SetFilePointerEx(h, size, NULL, FILE_BEGIN) || !SetEndOfFile(h))
+	{
+		CloseHandle(h);
+		return -1;
+	}
+	
+	*fd = h;
+	return 0;
+#else
+	int h;
+	
+	if ((h = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		return -1;
+	
+	/* extending a file leaves a hole */
+	if (ftruncate(h, sz))
+	{
+		close(h);
+		return -1;
+	}
+	
+	*fd = h;
+	return 0;
+#endif
+}
+
+
+/* write `sz` bytes to a file at `offset`; returns non-zero on failure */
+WOW_API_PREFIX
+int
+wow_pwrite(wow_fd fd, void const *data, size_t sz, size_t offset)
+{
+	const unsigned char *d = data;
+	
+	while (sz)
+	{
+#ifdef _WIN32
+		OVERLAPPED ov = { 0 };
+		unsigned long long o = offset;
+		DWORD n = sz > 0x40000000 ? 0x40000000 : sz;
+		DWORD wrote;
+		
+		ov.Offset = o & 0xffffffff;
+		ov.OffsetHigh = o >> 32;
+		if (!WriteFile(fd, d, n, &wrote, &ov) || !wrote)
+			return -1;
+#else
+		ssize_t wrote = pwrite(fd, d, sz, offset);
+		
+		if (wrote <= 0)
+			return -1;
+#endif
+		d += wrote;
+		sz -= wrote;
+		offset += wrote;
+	}
+	
+	return 0;
+}
+
+
+/* close a file opened by wow_open_sparse; returns non-zero on failure */
+WOW_API_PREFIX
+int
+wow_close_fd(wow_fd fd)
+{
+#ifdef _WIN32
+	return !CloseHandle(fd);
+#else
+	return close(fd);
+#endif
+}
+
+
+/* returns non-zero if both paths refer to the same existing file */
+WOW_API_PREFIX
+int
+wow_same_file(char const *a, char const *b)
+{
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION ia;
+	BY_HANDLE_FILE_INFORMATION ib;
+	HANDLE ha;
+	HANDLE hb;
+	int rv = 0;
+	
+	/* st_ino isn't meaningful on windows, so compare file ids */
+	ha = wow_create_file(a, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS);
+	hb = wow_create_file(b, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS);
+	if (ha != INVALID_HANDLE_VALUE && hb != INVALID_HANDLE_VALUE
+		&& GetFileInformationByHandle(ha, &ia)
+		&& GetFileInformationByHandle(hb, &ib)
+	)
+		rv = ia.dwVolumeSerialNumber == ib.dwVolumeSerialNumber
+			&& ia.nFileIndexHigh == ib.nFileIndexHigh
+			&& ia.nFileIndexLow == ib.nFileIndexLow;
+	if (ha != INVALID_HANDLE_VALUE)
+		CloseHandle(ha);
+	if (hb != INVALID_HANDLE_VALUE)
+		CloseHandle(hb);
+	
+	return rv;
+#else
+	struct stat sa;
+	struct stat sb;
+	
+	if (stat(a, &sa) || stat(b, &sb))
+		return 0;
+	
+	return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+
+/* qsort callback for wow_list_dir */
+static int wow_cmp_name(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/* list the regular files in a directory, sorted by name; returns *
+ * an array of `*num` paths ("dir/name") and a null terminator,   *
+ * or 0 if the directory can't be opened; free each path and the  *
+ * array when done with them                                      */
+WOW_API_PREFIX
+char **
+wow_list_dir(char const *path, int *num)
+{
+	char **list = 0;
+	int cap = 0;
+	int n = 0;
+	size_t pathLen = strlen(path);
+	const char *sep = (pathLen && strchr("/\\", path[pathLen - 1])) ? "" : "/";
+#ifdef _WIN32
+	HANDLE h;
+	char *pattern = malloc_safe(pathLen + 3);
+ #ifdef UNICODE
+	WIN32_FIND_DATAW fd;
+	void *wpattern;
+	
+	sprintf(pattern, "%s%s*", path, sep);
+	wpattern = wow_utf8_to_wchar(pattern);
+	h = FindFirstFileW(wpattern, &fd);
+	free(wpattern);
+ #else
+	WIN32_FIND_DATAA fd;
+	
+	sprintf(pattern, "%s%s*", path, sep);
+	h = FindFirstFileA(pattern, &fd);
+ #endif
+	free(pattern);
+	if (h == INVALID_HANDLE_VALUE)
+		return 0;
+	do
+	{
+ #ifdef UNICODE
+		char *name = wow_wchar_to_utf8(fd.cFileName);
+ #else
+		char *name = strdup_safe(fd.cFileName);
+ #endif
+		char *full;
+		
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			free(name);
+			continue;
+		}
+#else
+	DIR *dir = opendir(path);
+	struct dirent *ent;
+	
+	if (!dir)
+		return 0;
+	while ((ent = readdir(dir)))
+	{
+		char *name = ent->d_name;
+		char *full;
+#endif
+		full = malloc_safe(pathLen + strlen(sep) + strlen(name) + 1);
+		sprintf(full, "%s%s%s", path, sep, name);
+#ifdef _WIN32
+		free(name);
+#else
+		/* d_type isn't reliable on every filesystem */
+		{
+			struct stat s;
+			
+			if (stat(full, &s) || !S_ISREG(s.st_mode))
+			{
+				free(full);
+				continue;
+			}
+		}
+#endif
+		if (n + 1 >= cap)
+		{
+			cap = cap ? cap * 2 : 16;
+			list = realloc_safe(list, sizeof(*list) * cap);
+		}
+		list[n++] = full;
+#ifdef _WIN32
+	} while (FindNextFile(h, &fd));
+	FindClose(h);
+#else
+	}
+	closedir(dir);
+#endif
+	if (!list)
+		list = malloc_safe(sizeof(*list));
+	list[n] = 0;
+	
+	qsort(list, n, sizeof(*list), wow_cmp_name);
+	*num = n;
+	
+	return list;
+}
+
 #endif /* WOW_IMPLEMENTATION */
 
 #endif /* WOW_H_INCLUDED */
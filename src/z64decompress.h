@@ -0,0 +1,94 @@
+/*
+ * z64decompress.h <z64.me>
+ *
+ * libz64decompress: decompress z64 roms and individual files
+ * from one buffer into another, without touching the filesystem
+ *
+ * every function is reentrant and keeps no state between calls,
+ * so any number of threads may decompress at once; errors are
+ * returned rather than ending the program, and a corrupt rom or
+ * file is never read or written past the buffers given for it
+ *
+ * the output goes only where the caller says; the one thing
+ * allocated is about 58 KB of tables for each zlib file, freed
+ * before returning, and if that fails the file is decoded by a
+ * slower inflater that needs none
+ *
+ */
+
+#ifndef Z64DECOMPRESS_H_INCLUDED
+#define Z64DECOMPRESS_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#if defined(__GNUC__)
+ #define Z64DECOMPRESS_API __attribute__((visibility("default")))
+#else
+ #define Z64DECOMPRESS_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* return codes */
+enum z64decompress_error
+{
+	Z64DECOMPRESS_OK = 0,
+	Z64DECOMPRESS_ERR_ARG,      /* invalid argument (e.g. an unknown codec name) */
+	Z64DECOMPRESS_ERR_NODMA,    /* no dmadata in the rom */
+	Z64DECOMPRESS_ERR_CODEC,    /* a compressed file's codec is unknown */
+	Z64DECOMPRESS_ERR_SPACE,    /* the output doesn't fit; *decSz says how big it is */
+	Z64DECOMPRESS_ERR_DATA      /* a file lies outside the input, or won't decompress */
+};
+
+/* how a rom is decompressed; see z64decompress_opts_init() for defaults */
+struct z64decompress_opts
+{
+	const char *codec;   /* codec of every compressed file ("yaz", "lzo", "ucl", *
+	                      * "aplib" or "zlib"), or NULL to detect each one       */
+	int headerless;      /* non-zero if files have no 8-byte header *
+	                      * (iQue roms are always headerless)       */
+	long dmaOffset;      /* rom offset of dmadata, or -1 to search for it */
+	size_t align;        /* the decompressed rom size is rounded up to a *
+	                      * multiple of this (a power of two), or to the *
+	                      * next power of two if 0                       */
+};
+
+/* fill in the default options: detect each codec, files have headers, *
+ * search for dmadata, and round up to the next power of two          */
+Z64DECOMPRESS_API
+void z64decompress_opts_init(struct z64decompress_opts *opts);
+
+/* size the decompressed rom will be, written to *decSz */
+Z64DECOMPRESS_API
+int z64decompress_rom_size(const void *rom, size_t romSz, const struct z64decompress_opts *opts, size_t *decSz);
+
+/* decompress a rom into dst, which has room for dstMax bytes and *
+ * must not overlap it; writes the size of the decompressed rom   *
+ * to *decSz, also on Z64DECOMPRESS_ERR_SPACE; opts may be NULL   *
+ * for the defaults                                               */
+Z64DECOMPRESS_API
+int z64decompress_rom(const void *rom, size_t romSz, void *dst, size_t dstMax, size_t *decSz, const struct z64decompress_opts *opts);
+
+/* size an individual compressed file will decompress to, *
+ * as given in its header, written to *decSz              */
+Z64DECOMPRESS_API
+int z64decompress_file_size(const void *src, size_t srcSz, size_t *decSz);
+
+/* decompress an individual file into dst, which has room for dstMax   *
+ * bytes and must not overlap it; `codec` is as in z64decompress_opts; *
+ * writes the decompressed size to *decSz, also on                     *
+ * Z64DECOMPRESS_ERR_SPACE                                             */
+Z64DECOMPRESS_API
+int z64decompress_file(const void *src, size_t srcSz, void *dst, size_t dstMax, size_t *decSz, const char *codec);
+
+/* description of a return code */
+Z64DECOMPRESS_API
+const char *z64decompress_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* Z64DECOMPRESS_H_INCLUDED */
@@ -0,0 +1,97 @@
+/* a libFuzzer entry point for one decoder in safe mode, chosen with *
+ * -DFUZZ_DECODE=yazdec_ctx and so on (see `make fuzz`); built with   *
+ * -DFUZZ_MAIN, it decodes the files named on the command line, or    *
+ * stdin, instead, which is what afl-gcc and reproducing a crash need */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/decoder/decoder.h"
+
+#ifndef FUZZ_DECODE
+	#error "build with -DFUZZ_DECODE=<decoder>, e.g. -DFUZZ_DECODE=yazdec_ctx"
+#endif
+
+/* outputs bigger than this aren't worth the fuzzer's time; a header *
+ * claiming more is decoded with this as dst_max, and must fail      */
+#define FUZZ_DST_MAX 0x100000
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	struct z64dec_ctx ctx;
+	unsigned char *src;
+	unsigned char *dst;
+	size_t room = z64dec_header_size(data, size);
+	size_t n;
+
+	/* both are copied to buffers of exactly the right size, so *
+	 * the sanitizers catch the decoder straying past either    */
+	z64dec_ctx_init(&ctx, Z64DEC_FLAT | Z64DEC_SAFE);
+	if (room == 0 || room > FUZZ_DST_MAX)
+		ctx.dst_max = room = FUZZ_DST_MAX;
+	src = malloc(size ? size : 1);
+	dst = malloc(room);
+	if (!src || !dst)
+		abort();
+	memcpy(src, data, size);
+
+	n = FUZZ_DECODE(&ctx, src, dst, size);
+	if (n > room)
+		abort();
+	if (n && ctx.src_end > src + size)
+		abort();
+
+	free(dst);
+	free(src);
+
+	return 0;
+}
+
+#ifdef FUZZ_MAIN
+static void fuzz_file(FILE *fp)
+{
+	unsigned char *data = NULL;
+	size_t size = 0;
+	size_t max = 0;
+	size_t n;
+
+	do
+	{
+		if (size == max)
+		{
+			max = max ? max * 2 : 0x10000;
+			if (!(data = realloc(data, max)))
+				abort();
+		}
+		n = fread(data + size, 1, max - size, fp);
+		size += n;
+	} while (n);
+
+	LLVMFuzzerTestOneInput(data, size);
+	free(data);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 2)
+		fuzz_file(stdin);
+
+	for (i = 1; i < argc; ++i)
+	{
+		FILE *fp = fopen(argv[i], "rb");
+
+		if (!fp)
+		{
+			fprintf(stderr, "failed to open '%s'\n", argv[i]);
+			return 1;
+		}
+		fuzz_file(fp);
+		fclose(fp);
+	}
+
+	return 0;
+}
+#endif /* FUZZ_MAIN */
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "../src/codec.h"
+#include "../src/romview.h"
+#include "../src/verify.h"
+#include "../src/decoder/decoder.h"
+#include "../src/decoder/private.h"
+
+/* built in rather than linked, for the checksum internals */
+#include "../src/n64crc.h"
+#include "../src/n64crc.c"
+
+/* room past the end of each output, to catch a decoder writing on *
+ * past it; only those not in safe mode may overshoot into it       */
+#define GUARD      64
+#define GUARD_BYTE 0xA5
+
+/* the samples in test/samples: each is "<name>.raw", and the same *
+ * compressed with every codec, as "<name>.<codec name>"           */
+static const char *sampleName[] = {
+	"byte",  /* a single byte */
+	"rand",  /* doesn't compress */
+	"text",  /* mostly literals, with some short matches */
+	"mix",   /* a bit of everything */
+	"rle",   /* long runs, bigger than a yazdec_stream chunk */
+};
+
+/* every way a decoder can be called */
+static const struct {
+	const char *name;
+	unsigned flags;
+} decodeMode[] = {
+	{ "dma" , 0 },
+	{ "flat", Z64DEC_FLAT },
+	{ "safe", Z64DEC_FLAT | Z64DEC_SAFE },
+};
+
+static int checks = 0;
+static int failed = 0;
+
+/* count a check, reporting it if it failed; returns `ok` */
+static int check(int ok, const char *fmt, ...)
+{
+	va_list ap;
+
+	checks++;
+	if (ok)
+		return 1;
+
+	failed++;
+	printf("FAIL ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+
+	return 0;
+}
+
+/* load a whole file; returns NULL if it can't be read */
+static unsigned char *load(const char *dir, const char *name, const char *ext, size_t *sz)
+{
+	char path[1024];
+	unsigned char *data;
+	FILE *fp;
+	long end;
+
+	snprintf(path, sizeof(path), "%s/%s.%s", dir, name, ext);
+	if (!(fp = fopen(path, "rb")))
+		return NULL;
+
+	if (fseek(fp, 0, SEEK_END) || (end = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET))
+	{
+		fclose(fp);
+		return NULL;
+	}
+	data = malloc(end + 1);
+	if (!data || fread(data, 1, end, fp) != (size_t)end)
+	{
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	*sz = end;
+
+	return data;
+}
+
+/* whether the guard behind an output of sz bytes is untouched */
+static int guard_intact(const unsigned char *dst, size_t sz)
+{
+	int i;
+
+	for (i = 0; i < GUARD; ++i)
+		if (dst[sz + i] != GUARD_BYTE)
+			return 0;
+
+	return 1;
+}
+
+/* yazdec_stream output, collected in one place */
+struct stream_out
+{
+	unsigned char *data;
+	size_t sz;
+	size_t max;
+};
+
+static int stream_write(void *udata, const void *data, size_t sz)
+{
+	struct stream_out *out = udata;
+
+	if (sz > out->max - out->sz)
+		return 1;
+	memcpy(out->data + out->sz, data, sz);
+	out->sz += sz;
+
+	return 0;
+}
+
+/* decode one sample every way, byte for byte */
+static void test_sample(const char *dir, const char *name, Codec codec)
+{
+	const char *ext = decCodecInfo[codec].name;
+	struct z64dec_ctx ctx;
+	unsigned char *raw;
+	unsigned char *comp;
+	unsigned char *dma;
+	unsigned char *dst;
+	size_t rawSz;
+	size_t compSz;
+	size_t n;
+	int i;
+
+	raw = load(dir, name, "raw", &rawSz);
+	comp = load(dir, name, ext, &compSz);
+	if (!check(raw && comp, "%s.%s: missing from '%s'", name, ext, dir))
+	{
+		free(raw);
+		free(comp);
+		return;
+	}
+	dst = malloc(rawSz + GUARD);
+
+	/* the dma path reads whole blocks of `buf`, perhaps past the end *
+	 * of the file, as it would from a rom; the others get no more    *
+	 * than the file, so a sanitizer can tell if they read past it    */
+	dma = calloc(1, compSz + sizeof(ctx.buf));
+	memcpy(dma, comp, compSz);
+
+	for (i = 0; i < (int)(sizeof(decodeMode) / sizeof(*decodeMode)); ++i)
+	{
+		const char *mode = decodeMode[i].name;
+		unsigned char *src = (decodeMode[i].flags & Z64DEC_FLAT) ? comp : dma;
+
+		memset(dst, GUARD_BYTE, rawSz + GUARD);
+		z64dec_ctx_init(&ctx, decodeMode[i].flags);
+		n = decCodecInfo[codec].decode(&ctx, src, dst, compSz);
+		check(n == rawSz, "%s.%s: %s path returned %zu, not %zu", name, ext, mode, n, rawSz);
+		check(!memcmp(dst, raw, rawSz), "%s.%s: %s path decoded the wrong bytes", name, ext, mode);
+	}
+
+	/* safe mode never writes past dst_max, and gives up on a file *
+	 * that doesn't fit it, or that is cut short                   */
+	memset(dst, GUARD_BYTE, rawSz + GUARD);
+	z64dec_ctx_init(&ctx, Z64DEC_FLAT | Z64DEC_SAFE);
+	ctx.dst_max = rawSz;
+	n = decCodecInfo[codec].decode(&ctx, comp, dst, compSz);
+	check(n == rawSz && !memcmp(dst, raw, rawSz), "%s.%s: safe path failed with dst_max", name, ext);
+	check(guard_intact(dst, rawSz), "%s.%s: safe path wrote past dst_max", name, ext);
+	if (rawSz > 1)
+	{
+		ctx.dst_max = rawSz - 1;
+		n = decCodecInfo[codec].decode(&ctx, comp, dst, compSz);
+		check(n == 0, "%s.%s: safe path decoded %zu bytes into %zu", name, ext, n, rawSz - 1);
+		check(guard_intact(dst, rawSz), "%s.%s: safe path wrote past a short dst_max", name, ext);
+	}
+	ctx.dst_max = rawSz;
+	n = decCodecInfo[codec].decode(&ctx, comp, dst, compSz / 2);
+	check(n == 0, "%s.%s: safe path decoded half a file", name, ext);
+
+	/* and streamed, every way */
+	if (codec == CODEC_YAZ0)
+	{
+		struct stream_out out = { dst, 0, rawSz + GUARD };
+
+		for (i = 0; i < (int)(sizeof(decodeMode) / sizeof(*decodeMode)); ++i)
+		{
+			const char *mode = decodeMode[i].name;
+			unsigned char *src = (decodeMode[i].flags & Z64DEC_FLAT) ? comp : dma;
+
+			out.sz = 0;
+			z64dec_ctx_init(&ctx, decodeMode[i].flags);
+			n = yazdec_stream(&ctx, src, compSz, stream_write, &out);
+			check(n == rawSz && out.sz == rawSz, "%s.%s: %s stream returned %zu, not %zu", name, ext, mode, n, rawSz);
+			check(!memcmp(dst, raw, rawSz), "%s.%s: %s stream decoded the wrong bytes", name, ext, mode);
+		}
+	}
+
+	free(dma);
+	free(dst);
+	free(comp);
+	free(raw);
+}
+
+/* where test_romview puts dmadata and its one file in the rom */
+#define ROM_DMA  0x2000
+#define ROM_FILE 0x3000
+
+/* store a big-endian word */
+static void put_be32(unsigned char *b, unsigned int v)
+{
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* a rom holding a sample as its only file passes romview_check, *
+ * but not once Pend is moved back to cut the file short         */
+static void test_romview(const char *dir, const char *name, Codec codec)
+{
+	static const unsigned int table[3][4] = {
+		{ 0, 0x1060, 0, 0 },
+		{ 0x1060, ROM_DMA, 0x1060, 0 },
+		{ ROM_DMA, ROM_DMA + STRIDE * 4, ROM_DMA, 0 },
+	};
+	const char *ext = decCodecInfo[codec].name;
+	struct romview *view;
+	unsigned char *rom;
+	unsigned char *raw;
+	unsigned char *comp;
+	unsigned char *dst;
+	unsigned char *dma;
+	unsigned int entry[4];
+	size_t rawSz;
+	size_t compSz;
+	size_t romSz;
+	RomviewStatus status;
+	int i;
+	int k;
+
+	raw = load(dir, name, "raw", &rawSz);
+	comp = load(dir, name, ext, &compSz);
+	if (!check(raw && comp, "%s.%s: missing from '%s'", name, ext, dir))
+	{
+		free(raw);
+		free(comp);
+		return;
+	}
+	romSz = ROM_FILE + compSz;
+	rom = calloc(1, romSz);
+	dst = malloc(rawSz);
+	memcpy(rom + ROM_FILE, comp, compSz);
+
+	entry[0] = ROM_FILE;
+	entry[1] = ROM_FILE + rawSz;
+	entry[2] = ROM_FILE;
+	entry[3] = ROM_FILE + compSz;
+	for (i = 0; i < 4; ++i)
+	{
+		dma = rom + ROM_DMA + STRIDE * i;
+		for (k = 0; k < 4; ++k)
+			put_be32(dma + k * 4, i < 3 ? table[i][k] : entry[k]);
+	}
+
+	view = romview_open(rom, romSz, ROM_DMA, codec, 0);
+	if (check(view != NULL, "%s.%s: romview_open found no dmadata", name, ext))
+	{
+		status = romview_check(view, 3, dst, rawSz);
+		check(status == ROMVIEW_OK, "%s.%s: romview_check says %s", name, ext, romview_status_name(status));
+		check(!memcmp(dst, raw, rawSz), "%s.%s: romview_check decoded the wrong bytes", name, ext);
+
+		/* Pend is rewritten in place; the view reads dmadata as it goes */
+		put_be32(rom + ROM_DMA + STRIDE * 3 + 12, ROM_FILE + compSz / 2);
+		status = romview_check(view, 3, dst, rawSz);
+		check(status == ROMVIEW_OVERREAD, "%s.%s: romview_check says %s with Pend cut short", name, ext, romview_status_name(status));
+
+		romview_close(view);
+	}
+
+	free(dst);
+	free(rom);
+	free(comp);
+	free(raw);
+}
+
+/* verify_rom on a rom with this many dma entries, all but the first *
+ * three of them failing; past a million, their report lines are     *
+ * longer than the 64 bytes first allowed for each, by more than the *
+ * shorter ones before them make up for                               */
+#define VERIFY_ENTRIES 1300000
+#define VERIFY_FILE    0x1800 /* ROM_FILE is inside so long a table */
+
+/* a report as long as the dmadata table comes out whole */
+static void test_verify(void)
+{
+	const size_t romSz = ROM_DMA + STRIDE * VERIFY_ENTRIES;
+	void *scratch = NULL;
+	size_t scratchSz = 0;
+	unsigned char *rom;
+	unsigned char *dma;
+	char line[256];
+	char last[256] = "";
+	char want[256];
+	int lines = 0;
+	int bad;
+	FILE *out;
+	int i;
+
+	if (!check((out = tmpfile()) != NULL, "verify: no temporary file"))
+		return;
+	rom = calloc(1, romSz);
+
+	/* every file is a yaz header with nothing valid behind it */
+	memcpy(rom + VERIFY_FILE, "Yaz0", 4);
+	put_be32(rom + VERIFY_FILE + 4, 0x100);
+	for (i = 0, dma = rom + ROM_DMA; i < VERIFY_ENTRIES; ++i, dma += STRIDE)
+	{
+		static const unsigned int table[3][4] = {
+			{ 0, 0x1060, 0, 0 },
+			{ 0x1060, ROM_DMA, 0x1060, 0 },
+			{ ROM_DMA, ROM_DMA + STRIDE * VERIFY_ENTRIES, ROM_DMA, 0 },
+		};
+		const unsigned int file[4] = { 0, 0x100, VERIFY_FILE, VERIFY_FILE + 0x20 };
+		int k;
+
+		for (k = 0; k < 4; ++k)
+			put_be32(dma + k * 4, i < 3 ? table[i][k] : file[k]);
+	}
+
+	bad = verify_rom("long", rom, romSz, &scratch, &scratchSz, CODEC_NONE, 0, ROM_DMA, out);
+	check(bad == VERIFY_ENTRIES - 3, "verify: %d problems, not %d", bad, VERIFY_ENTRIES - 3);
+
+	/* the last file's line is as long as they get */
+	rewind(out);
+	while (fgets(line, sizeof(line), out))
+	{
+		if (strncmp(line, "'long'", 6))
+			strcpy(last, line);
+		lines++;
+	}
+	snprintf(want, sizeof(want), "%d yaz   00000000 00000100 FAIL, decompressed size mismatch\n", VERIFY_ENTRIES - 1);
+	check(!strcmp(last, want), "verify: last file's line is '%s'", last);
+	snprintf(want, sizeof(want), "'long': FAIL, %d files, %d failed, crc unknown (unrecognised CIC)\n"
+		, VERIFY_ENTRIES, VERIFY_ENTRIES - 3
+	);
+	check(lines == VERIFY_ENTRIES + 1, "verify: %d report lines, not %d", lines, VERIFY_ENTRIES + 1);
+	check(!strcmp(line, want), "verify: report ends '%s'", line);
+
+	fclose(out);
+	free(scratch);
+	free(rom);
+}
+
+/* match_copy and match_copy_fast are checked against a plain byte  *
+ * loop for every distance up to this, which covers each path they   *
+ * take, and every length up to MATCH_N_MAX                          */
+#define MATCH_DIST_MAX 20
+#define MATCH_N_MAX    300
+
+/* one back-reference; match_copy_fast is given `room`, and may write *
+ * up to it, but match_copy may not write past the end of the match   */
+static int match_ok(size_t dist, size_t n, size_t room, int fast)
+{
+	unsigned char want[MATCH_DIST_MAX + MATCH_N_MAX + 16 + GUARD];
+	unsigned char got[sizeof(want)];
+	unsigned char *dst = got + MATCH_DIST_MAX;
+	unsigned char *end;
+	size_t i;
+
+	/* a window of distinct bytes, so a pattern out of phase shows */
+	memset(want, GUARD_BYTE, sizeof(want));
+	for (i = 0; i < MATCH_DIST_MAX; ++i)
+		want[i] = i * 37 + 11;
+	memcpy(got, want, sizeof(got));
+	for (i = 0; i < n; ++i)
+		want[MATCH_DIST_MAX + i] = want[MATCH_DIST_MAX + i - dist];
+
+	if (fast)
+		end = match_copy_fast(dst, dst - dist, n, room);
+	else
+		end = match_copy(dst, dst - dist, n);
+
+	if (!fast)
+		room = n;
+	for (i = MATCH_DIST_MAX + room; i < sizeof(got); ++i)
+		if (got[i] != GUARD_BYTE)
+			return 0;
+
+	return end == dst + n && !memcmp(got, want, MATCH_DIST_MAX + n);
+}
+
+/* every distance and length, with match_copy_fast given from exactly *
+ * as much room as the match to more than its 16-byte chunks need;    *
+ * distance 0 only comes from a corrupt file, but mustn't hang        */
+static void test_match_copy(void)
+{
+	size_t dist;
+	size_t n;
+	size_t room;
+
+	for (dist = 0; dist <= MATCH_DIST_MAX; ++dist)
+	{
+		for (n = 1; n <= MATCH_N_MAX; ++n)
+			if (!match_ok(dist, n, n, 0))
+				break;
+		check(n > MATCH_N_MAX, "match_copy: distance %zu, length %zu", dist, n);
+
+		for (n = 1; n <= MATCH_N_MAX; ++n)
+		{
+			for (room = n; room <= n + 16; ++room)
+				if (!match_ok(dist, n, room, 1))
+					break;
+			if (room <= n + 16)
+				break;
+		}
+		check(n > MATCH_N_MAX, "match_copy_fast: distance %zu, length %zu, room %zu", dist, n, room);
+	}
+}
+
+/* the checksum loop as it was first written, which checksum_fast() *
+ * must match with every checksum_words()                            */
+static void checksum_scalar(
+	struct checksum *c
+	, int bootcode
+	, unsigned char *data
+)
+{
+	unsigned int t1 = c->t1, t2 = c->t2, t3 = c->t3;
+	unsigned int t4 = c->t4, t5 = c->t5, t6 = c->t6;
+	unsigned int r, d;
+	int i;
+
+	i = CHECKSUM_START;
+	while (i < (CHECKSUM_START + CHECKSUM_LENGTH)) {
+		d = BYTES2LONG(&data[i]);
+		if ((t6 + d) < t6)
+			t4++;
+		t6 += d;
+		t3 ^= d;
+		r = ROL(d, (d & 0x1F));
+		t5 += r;
+		if (t2 > d)
+			t2 ^= r;
+		else
+			t2 ^= t6 ^ d;
+
+		if (bootcode == 6105)
+			t1 += BYTES2LONG(&data[N64_HEADER_SIZE + 0x0710 + (i & 0xFF)]) ^ d;
+		else
+			t1 += t5 ^ d;
+
+		i += 4;
+	}
+
+	c->t1 = t1; c->t2 = t2; c->t3 = t3;
+	c->t4 = t4; c->t5 = t5; c->t6 = t6;
+}
+
+/* every checksum_words() this build has */
+static const struct {
+	const char *name;
+	checksum_words_fn *words;
+} crcWords[] = {
+	{ "scalar", checksum_words_scalar },
+#if defined(__SSE2__)
+	{ "sse2", checksum_words_sse2 },
+#endif
+#if defined(__ARM_NEON)
+	{ "neon", checksum_words_neon },
+#endif
+#if defined(__AVX2__) || N64CRC_DISPATCH
+	{ "avx2", checksum_words_avx2 },
+#endif
+	{ "dispatch", checksum_words },
+};
+
+/* every CIC, with the crc32 N64GetCIC() knows its bootcode by, and *
+ * the seed its checksum starts from                                */
+static const struct {
+	int cic;
+	unsigned int bootcodeCrc;
+	unsigned int seed;
+} crcCic[] = {
+	{ 6101, 0x6170A4A1, CHECKSUM_CIC6102 },
+	{ 6102, 0x90BB6CB5, CHECKSUM_CIC6102 },
+	{ 6103, 0x0B050EE0, CHECKSUM_CIC6103 },
+	{ 6105, 0x98BC2C86, CHECKSUM_CIC6105 },
+	{ 6106, 0xACC8580A, CHECKSUM_CIC6106 },
+};
+
+/* the real bootcodes can't be shipped, but only their crc32 is     *
+ * checked, and the last four bytes of any bootcode can be picked   *
+ * to give whatever crc32 is wanted: working back from the end, each *
+ * byte has to pick the one entry of crc_table[0] with the high     *
+ * byte that leads to the next state                                */
+static void forge_bootcode(unsigned char *rom, unsigned int crc)
+{
+	unsigned char *boot = rom + N64_HEADER_SIZE;
+	unsigned char idx[4];
+	unsigned int want = ~crc;
+	unsigned int state = ~0u;
+	int i;
+	int j;
+
+	for (i = 3; i >= 0; --i)
+	{
+		for (j = 0; (crc_table[0][j] >> 24) != (want >> 24); ++j)
+			;
+		idx[i] = j;
+		want = (want ^ crc_table[0][j]) << 8;
+	}
+
+	for (i = 0; i < N64_BC_SIZE - 4; ++i)
+		state = (state >> 8) ^ crc_table[0][(state ^ boot[i]) & 0xFF];
+	for (i = 0; i < 4; ++i)
+	{
+		boot[N64_BC_SIZE - 4 + i] = (state ^ idx[i]) & 0xFF;
+		state = (state >> 8) ^ crc_table[0][idx[i]];
+	}
+}
+
+/* a rom for each CIC, filled with noise and then with 0xFF (which *
+ * carries out of t6 on every word); each checksum_words() has to  *
+ * give the same checksum as the original loop, and n64crc() a crc *
+ * that n64crc_check() then agrees with                            */
+static void test_crc(void)
+{
+	unsigned char *rom = malloc(N64CRC_ROM_MIN);
+	unsigned int seed = 1;
+	int fill;
+	int i;
+	int k;
+
+	for (fill = 0; fill < 2; ++fill)
+	{
+		for (i = 0; i < N64CRC_ROM_MIN; ++i)
+		{
+			seed = seed * 1103515245 + 12345;
+			rom[i] = fill ? 0xFF : seed >> 16;
+		}
+
+		for (i = 0; i < (int)(sizeof(crcCic) / sizeof(*crcCic)); ++i)
+		{
+			const int cic = crcCic[i].cic;
+			struct checksum ref;
+
+			forge_bootcode(rom, crcCic[i].bootcodeCrc);
+			if (!check(N64GetCIC(rom) == cic, "crc: bootcode not taken for %d", cic))
+				continue;
+
+			ref.t1 = ref.t2 = ref.t3 = ref.t4 = ref.t5 = ref.t6 = crcCic[i].seed;
+			checksum_scalar(&ref, cic, rom);
+
+			for (k = 0; k < (int)(sizeof(crcWords) / sizeof(*crcWords)); ++k)
+			{
+				struct checksum c;
+
+#if N64CRC_DISPATCH
+				if (crcWords[k].words == checksum_words_avx2 && !__builtin_cpu_supports("avx2"))
+					continue;
+#endif
+				c.t1 = c.t2 = c.t3 = c.t4 = c.t5 = c.t6 = crcCic[i].seed;
+				checksum_fast(&c, cic == 6105, rom, crcWords[k].words);
+				check(!memcmp(&c, &ref, sizeof(c)), "crc: %s checksum wrong for %d", crcWords[k].name, cic);
+			}
+
+			n64crc(rom);
+			check(n64crc_check(rom) == 0, "crc: n64crc() and n64crc_check() disagree for %d", cic);
+			rom[N64_CRC2 + 3] ^= 1;
+			check(n64crc_check(rom) == 1, "crc: n64crc_check() missed a bad crc for %d", cic);
+		}
+	}
+
+	free(rom);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = argc > 1 ? argv[1] : "test/samples";
+	int i;
+	int c;
+
+	/* cache sidecars only have room for names this long */
+	for (c = 0; c < CODEC_MAX; ++c)
+		check(strlen(decCodecInfo[c].name) <= CODEC_NAME_MAX, "%s: name longer than CODEC_NAME_MAX", decCodecInfo[c].name);
+	for (i = 0; i < (int)(sizeof(sampleName) / sizeof(*sampleName)); ++i)
+		for (c = 0; c < CODEC_MAX; ++c)
+			test_sample(dir, sampleName[i], c);
+	for (c = 0; c < CODEC_MAX; ++c)
+		test_romview(dir, "mix", c);
+	test_verify();
+	test_match_copy();
+	test_crc();
+
+	printf("%d checks, %d failed\n", checks, failed);
+
+	return failed != 0;
+}